@@ -48,6 +48,9 @@ class Arrow : public Component {
 
   ArrowStatus astatus_ = PREDRAW;
 
+  // 渲染时复用的查询缓冲区
+  vector<Component*> collided_;
+
   Box GetBox(Vec2d pos1, Vec2d pos2) {
     double minx = min(pos1.x, pos2.x);
     double miny = min(pos1.y, pos2.y);
@@ -60,20 +63,78 @@ class Arrow : public Component {
 
   void UpdatePos() {
     if (start_ != nullptr && startport_ != nullptr) {
-      p1 = start_->box_.pos_ + start_->box_.size_ * startport_->pos;
+      p1 = start_->GetPortPos(*startport_);
     }
     if (end_ != nullptr && endport_ != nullptr) {
-      p2 = end_->box_.pos_ + end_->box_.size_ * endport_->pos;
+      p2 = end_->GetPortPos(*endport_);
+    }
+  }
+
+  // 根据端口位置更新端点与包围盒，端点改变时重绘新旧位置
+  void UpdateGeometry() {
+    Vec2d old1 = p1, old2 = p2;
+    UpdatePos();
+    SetBox(GetBox(p1, p2));
+    if (!(old1 == p1) || !(old2 == p2)) {
+      Invalidate();
+    }
+  }
+
+  // 绘制时光标附近的吸附端口
+  struct SnapPort {
+    Component* component = nullptr;
+    Port* port = nullptr;
+    double dist = 0;
+  };
+  SnapPort startsnap_, endsnap_;
+
+  static constexpr double kSnapRadius = 20;
+
+  // 端口都在组件包围盒内，按包围盒距离由近到远访问组件，
+  // 当包围盒距离已超过当前最近端口时即可停止
+  SnapPort FindNearestPort(SpatialIndex* node, Vec2d p, double radius) {
+    SnapPort res;
+    res.dist = radius;
+    node->QueryNearest(p, radius, [&](BoxedObj* obj, double dist) {
+      if (res.port != nullptr && dist > res.dist) {
+        return false;
+      }
+      Component* c = (Component*)obj;
+      if (c == this || c->IsArrow()) {
+        return true;
+      }
+      for (auto& i : c->ports_) {
+        double d = (c->GetPortPos(i) - p).Dist();
+        if (d <= res.dist) {
+          res.component = c;
+          res.port = &i;
+          res.dist = d;
+        }
+      }
+      return true;
+    });
+    return res;
+  }
+
+  // 返回离p最近的端口
+  static Port* NearestPort(Component* c, Vec2d p) {
+    Port* res = nullptr;
+    double best = 0;
+    for (auto& i : c->ports_) {
+      double d = (c->GetPortPos(i) - p).SquareDist();
+      if (res == nullptr || d < best) {
+        res = &i;
+        best = d;
+      }
     }
+    return res;
   }
 
-  void Render(QuadTreeNode* node, double w, double h) override {
+  void Render(SpatialIndex* node, double w, double h) override {
     UpdateSize(w, h);
 
-    UpdatePos();
     Vec2d pos1 = p1;
     Vec2d pos2 = p2;
-    box_ = GetBox(pos1, pos2);
     if (astatus_ == COMPLETED && start_ != nullptr && end_ != nullptr) {
       vector<pair<Vec2d, Vec2d>> parts;
 
@@ -86,15 +147,16 @@ class Arrow : public Component {
 
       vector<InterPoint> points;
 
-      auto t = node->Retrieve(box_);
-      vector<Component*> collided;
-      for (auto i : t) {
-        Component* ti = (Component*)i;
-        if (ti != this && ti != start_ && ti != end_ && !ti->IsArrow() &&
-            ti->IsCollided(box_)) {
+      vector<Component*>& collided = collided_;
+      collided.clear();
+      // 只取线段实际穿过的组件，而非包围盒内的全部组件
+      node->QuerySegment(pos1, pos2, [this, &collided](BoxedObj* obj) {
+        Component* ti = (Component*)obj;
+        if (ti != this && ti != start_ && ti != end_ && !ti->IsArrow()) {
           collided.push_back(ti);
         }
-      }
+        return true;
+      });
 
       for (auto i : collided) {
         auto p = i->GetLineIntersection(pos1, pos2);
@@ -274,6 +336,14 @@ class Arrow : public Component {
       path.lineTo(p2x, p2y);
       path.close();
       (*canvas)->drawPath(path, paint);
+
+      paint.setStyle(SkPaint::kStroke_Style);
+      if (startsnap_.port != nullptr) {
+        (*canvas)->drawCircle(pos1.x, pos1.y, 5, paint);
+      }
+      if (endsnap_.port != nullptr) {
+        (*canvas)->drawCircle(pos2.x, pos2.y, 5, paint);
+      }
     }
   }
 
@@ -312,66 +382,73 @@ class Arrow : public Component {
     return {};
   }
 
-  virtual void CursorEvent(QuadTreeNode* node, bool ldown, double xpos,
+  virtual void CursorEvent(SpatialIndex* node, bool ldown, double xpos,
                            double ypos, Vec2d velocity) override {
+    auto astatus = astatus_;
     if (astatus_ == PREDRAW) {
       if (ldown) {
         astatus_ = DRAWING;
         p1 = Vec2d(xpos, ypos);
-        p2 = Vec2d(xpos, ypos);
+        startsnap_ = FindNearestPort(node, p1, kSnapRadius);
+        if (startsnap_.port != nullptr) {
+          p1 = startsnap_.component->GetPortPos(*startsnap_.port);
+        }
+        p2 = p1;
       }
     } else if (astatus_ == DRAWING) {
       p2 = Vec2d(xpos, ypos);
+      endsnap_ = FindNearestPort(node, p2, kSnapRadius);
+      if (endsnap_.port != nullptr &&
+          endsnap_.component != startsnap_.component) {
+        p2 = endsnap_.component->GetPortPos(*endsnap_.port);
+      } else {
+        endsnap_ = SnapPort();
+      }
+    }
+    UpdateGeometry();
+    if (astatus != astatus_) {
+      Invalidate();
     }
   }
 
-  virtual void ButtonEvent(QuadTreeNode* node, int button, int type) override {
+  virtual void ButtonEvent(SpatialIndex* node, int button, int type) override {
     Component::ButtonEvent(node, button, type);
     if (button == 0 && type == 0 && astatus_ == DRAWING) {
       astatus_ = COMPLETED;
       BindComponent(node);
+      UpdateGeometry();
+      Invalidate();
     }
   }
 
-  void BindComponent(QuadTreeNode* node) {
-    auto t = node->Retrieve(Box(p1, Vec2d()));
-    Component* startc = nullptr;
-    for (auto i : t) {
-      Component* c = (Component*)i;
-      if (!c->IsArrow()) {
-        if (c->IsCollided(Box(p1, Vec2d()))) {
-          if (startc != nullptr) {
-            if (startc->depth_ > c->depth_) {
-              startc = c;
-            }
-          } else {
-            startc = c;
-          }
+  // 返回包含点p的最底层非箭头组件
+  Component* FindComponent(SpatialIndex* node, Vec2d p) {
+    Component* res = nullptr;
+    Box point(p, Vec2d());
+    node->QueryOverlap(point, [&](BoxedObj* obj) {
+      Component* c = (Component*)obj;
+      if (!c->IsArrow() && c->IsCollided(point)) {
+        if (res == nullptr || res->depth_ > c->depth_) {
+          res = c;
         }
       }
-    }
+      return true;
+    });
+    return res;
+  }
+
+  void BindComponent(SpatialIndex* node) {
+    Component* startc = startsnap_.component != nullptr
+                            ? startsnap_.component
+                            : FindComponent(node, p1);
     if (startc == nullptr) {
       astatus_ = FAIL;
       return;
     } else {
       start_ = startc;
     }
-    t = node->Retrieve(Box(p2, Vec2d()));
-    Component* endc = nullptr;
-    for (auto i : t) {
-      Component* c = (Component*)i;
-      if (!c->IsArrow()) {
-        if (c->IsCollided(Box(p2, Vec2d()))) {
-          if (endc != nullptr) {
-            if (endc->depth_ > c->depth_) {
-              endc = c;
-            }
-          } else {
-            endc = c;
-          }
-        }
-      }
-    }
+    Component* endc = endsnap_.component != nullptr ? endsnap_.component
+                                                    : FindComponent(node, p2);
     if (endc == nullptr) {
       astatus_ = FAIL;
       return;
@@ -384,37 +461,18 @@ class Arrow : public Component {
     }
     Vec2d startmid = start_->box_.Mid();
     Vec2d endmid = end_->box_.Mid();
-    auto startinter = start_->GetLineIntersection(startmid, endmid)[0];
-    auto endinter = end_->GetLineIntersection(startmid, endmid)[0];
-    Port* startport = nullptr;
-    for (auto& i : start_->ports_) {
-      if (startport != nullptr) {
-        if ((startport->pos * start_->box_.size_ + start_->box_.pos_ -
-             startinter)
-                .SquareDist() >
-            (i.pos * start_->box_.size_ + start_->box_.pos_ - startinter)
-                .SquareDist()) {
-          startport = &i;
-        }
-      } else {
-        startport = &i;
-      }
+    if (startsnap_.component == start_) {
+      startport_ = startsnap_.port;
+    } else {
+      auto startinter = start_->GetLineIntersection(startmid, endmid)[0];
+      startport_ = NearestPort(start_, startinter);
     }
-    startport_ = startport;
-    Port* endport = nullptr;
-    for (auto& i : end_->ports_) {
-      if (endport != nullptr) {
-        if ((endport->pos * end_->box_.size_ + end_->box_.pos_ - endinter)
-                .SquareDist() >
-            (i.pos * end_->box_.size_ + end_->box_.pos_ - endinter)
-                .SquareDist()) {
-          endport = &i;
-        }
-      } else {
-        endport = &i;
-      }
+    if (endsnap_.component == end_) {
+      endport_ = endsnap_.port;
+    } else {
+      auto endinter = end_->GetLineIntersection(startmid, endmid)[0];
+      endport_ = NearestPort(end_, endinter);
     }
-    endport_ = endport;
   }
 
   virtual bool IsArrow() override { return true; }
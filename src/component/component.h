@@ -18,7 +18,10 @@
 #include "harfbuzz/hb.h"
 #include "utils/box.h"
 #include "utils/boxedobj.h"
-#include "utils/quadtree.h"
+#include "utils/damage.h"
+#include "utils/lod.h"
+#include "utils/spatialindex.h"
+#include "utils/strokebatch.h"
 
 // GLFW
 #include "GLFW/glfw3.h"
@@ -27,6 +30,8 @@
 #define SK_GL
 #include "include/core/SkCanvas.h"
 #include "include/core/SkPaint.h"
+#include "include/core/SkPicture.h"
+#include "include/core/SkPictureRecorder.h"
 
 namespace mocoder {
 
@@ -49,6 +54,8 @@ class Component : public BoxedObj {
   };
 
   vector<Port> ports_;
+
+  Vec2d GetPortPos(const Port& port) { return box_.pos_ + box_.size_ * port.pos; }
   SkCanvas** canvas;
 
   TextInput text_;
@@ -70,7 +77,154 @@ class Component : public BoxedObj {
 
   int width = 0, height = 0;
 
-  virtual void Render(QuadTreeNode* node, double w, double h) = 0;
+  // 描边、箭头与端口标记超出包围盒的距离
+  static constexpr double kDamageMargin = 10;
+  // 外观改变时向其报告需要重绘的区域，未加入管理器时为nullptr
+  DamageTracker* damage_ = nullptr;
+  // 上次绘制时的绘制范围，由管理器在绘制后更新
+  Box last_drawn_;
+  bool drawn_ = false;
+
+  virtual void Render(SpatialIndex* node, double w, double h) = 0;
+
+  // 外形的录制结果，以包围盒左上角为原点；
+  // 移动时只改变平移，尺寸或选中状态改变时才重新录制
+  sk_sp<SkPicture> shape_;
+  Vec2d shape_size_;
+  bool shape_selected_ = false;
+
+  // 外形轮廓，以包围盒左上角为原点，尺寸改变时重新生成
+  SkPath shape_path_;
+  Vec2d path_size_;
+  bool has_path_ = false;
+  // 收集中时外形交给管理器合并绘制
+  StrokeBatch* batch_ = nullptr;
+  // 最近一次排入合并绘制的批次，由管理器判断重叠时使用
+  uint64_t batch_mark_ = 0;
+
+  // 以包围盒左上角为原点生成外形轮廓
+  virtual void BuildShape(SkPath* path) {}
+
+  // 选中时是否在包围盒上画虚线框
+  virtual bool DashedFrame() { return false; }
+
+  const SkPath& ShapePath() {
+    if (!has_path_ || !(path_size_ == box_.size_)) {
+      shape_path_.rewind();
+      BuildShape(&shape_path_);
+      path_size_ = box_.size_;
+      has_path_ = true;
+    }
+    return shape_path_;
+  }
+
+  // 以包围盒左上角为原点绘制外形
+  void DrawShape(SkCanvas* canvas, bool selected) {
+    canvas->drawPath(ShapePath(), StrokeBatch::MakePaint(
+                                      selected ? StrokeBatch::SELECTED
+                                               : StrokeBatch::NORMAL));
+    if (selected && DashedFrame()) {
+      canvas->drawRect(Box(Vec2d(0, 0), box_.size_).GetEdge(),
+                       StrokeBatch::MakePaint(StrokeBatch::DASHED));
+    }
+  }
+
+  void RenderShape() {
+    bool selected = Selected();
+    if (batch_ != nullptr &&
+        batch_->Add(selected ? StrokeBatch::SELECTED : StrokeBatch::NORMAL,
+                    ShapePath(), box_.pos_.x, box_.pos_.y)) {
+      if (selected && DashedFrame()) {
+        batch_->AddRect(StrokeBatch::DASHED, box_.GetEdge());
+      }
+      return;
+    }
+    if (shape_ == nullptr || !(shape_size_ == box_.size_) ||
+        shape_selected_ != selected) {
+      SkPictureRecorder recorder;
+      SkCanvas* c = recorder.beginRecording(
+          Box(Vec2d(0, 0), box_.size_).Outset(kDamageMargin).GetEdge());
+      DrawShape(c, selected);
+      shape_ = recorder.finishRecordingAsPicture();
+      shape_size_ = box_.size_;
+      shape_selected_ = selected;
+    }
+    (*canvas)->save();
+    (*canvas)->translate(box_.pos_.x, box_.pos_.y);
+    (*canvas)->drawPicture(shape_);
+    (*canvas)->restore();
+  }
+
+  // 本组件绘制可能覆盖的范围
+  virtual Box GetDrawBound() {
+    return text_.JoinBound(box_.Outset(kDamageMargin));
+  }
+
+  // 重绘上次绘制的位置与当前位置
+  void Invalidate() {
+    if (damage_ == nullptr) {
+      return;
+    }
+    if (drawn_) {
+      damage_->AddWorld(last_drawn_);
+    }
+    damage_->AddWorld(GetDrawBound());
+  }
+
+  void OnMoved(const Box& old) override { Invalidate(); }
+
+  // 组件内所有文本框改由图集绘制
+  virtual void SetTextAtlas(TextAtlas* atlas) { text_.SetAtlas(atlas); }
+
+  // 细节等级，由管理器随视图缩放更新，为空时总是完整绘制
+  const Lod* lod_ = nullptr;
+
+  // 组件的外形与文本框的灰条交给batch合并绘制
+  virtual void SetStrokeBatch(StrokeBatch* batch) {
+    batch_ = batch;
+    text_.batch_ = batch;
+  }
+
+  // 组件内所有文本框共用排版缓存
+  virtual void SetShapeCache(ShapeCache* shapes) {
+    text_.SetShapeCache(shapes);
+  }
+
+  // 组件内所有文本框使用同一细节等级
+  virtual void SetLod(const Lod* lod) {
+    lod_ = lod;
+    text_.lod_ = lod;
+  }
+
+  // 远景下外形画成填充的盒子、文字画成灰条，不排版文字；
+  // 按远景绘制时返回true，调用者不必再绘制
+  bool RenderGreeked() {
+    if (lod_ == nullptr || *lod_ != Lod::GREEK) {
+      return false;
+    }
+    SkPath bars;
+    text_.AddGreekBars(box_.Mid(), box_.size_.x - 30, &bars);
+    if (batch_ != nullptr &&
+        batch_->AddRect(StrokeBatch::FILL, box_.GetEdge())) {
+      batch_->Add(StrokeBatch::GREEK, bars, 0, 0);
+    } else {
+      (*canvas)->drawRect(box_.GetEdge(),
+                          StrokeBatch::MakePaint(StrokeBatch::FILL));
+      (*canvas)->drawPath(bars, StrokeBatch::MakePaint(StrokeBatch::GREEK));
+    }
+    // 选中的组件仍画出轮廓
+    if (Selected()) {
+      RenderShape();
+    }
+    return true;
+  }
+
+  // 每帧对选中的组件调用一次，光标闪烁切换明暗时重绘
+  void Tick(double now) {
+    if (text_.Tick(now)) {
+      Invalidate();
+    }
+  }
 
   bool Selected() {
     return status == Status::SELECTED || status == Status::MOVING ||
@@ -97,14 +251,24 @@ class Component : public BoxedObj {
     return inbox_;
   }
 
+  // 画布上可见的世界坐标范围，由管理器维护，为空时按窗口大小判断
+  const Box* view_ = nullptr;
+
   bool OutofWindow(Box box) {
+    if (view_ != nullptr) {
+      const Box& v = *view_;
+      return !(box.pos_.x > v.pos_.x &&
+               box.pos_.x + box.size_.x < v.pos_.x + v.size_.x &&
+               box.pos_.y >= v.pos_.y &&
+               box.pos_.y + box.size_.y < v.pos_.y + v.size_.y);
+    }
     return !(box.pos_.x > 100 && box.pos_.x + box.size_.x < width &&
              box_.pos_.y >= 0 && box.pos_.y + box.size_.y < height);
   }
 
   virtual bool IsCollided(Box box) { return box_.IsCollided(box); }
 
-  virtual void CursorEvent(QuadTreeNode* node, bool ldown, double xpos,
+  virtual void CursorEvent(SpatialIndex* node, bool ldown, double xpos,
                            double ypos, Vec2d velocity) {
     // GetInbox();
     if (!Selected()) {
@@ -263,7 +427,9 @@ class Component : public BoxedObj {
     }
   }
 
-  virtual void ButtonEvent(QuadTreeNode* node, int button, int type) {
+  virtual void ButtonEvent(SpatialIndex* node, int button, int type) {
+    bool selected = Selected();
+    auto textstatus = text_.status_;
     if (status == Status::UNSELECTED) {
       if (button == 0) {
         if (type == 1) {
@@ -290,9 +456,13 @@ class Component : public BoxedObj {
         if (editstatus == PREEDIT) {
           editstatus = EDITING;
           text_.status_ = TextInput::EDIT;
+          text_.ResetBlink();
         }
       }
     }
+    if (selected != Selected() || textstatus != text_.status_) {
+      Invalidate();
+    }
   }
 
   virtual int OnKeyboard(GLFWwindow* window, int key, int action,
@@ -305,19 +475,19 @@ class Component : public BoxedObj {
         } else if (action == GLFW_PRESS || action == GLFW_REPEAT) {
           if (key == GLFW_KEY_UP) {
             if (!OutofWindow(Box(box_.pos_ - Vec2d(0, 10), box_.size_))) {
-              box_.pos_.y -= 10;
+              SetBox(Box(box_.pos_ - Vec2d(0, 10), box_.size_));
             }
           } else if (key == GLFW_KEY_DOWN) {
             if (!OutofWindow(Box(box_.pos_ + Vec2d(0, 10), box_.size_))) {
-              box_.pos_.y += 10;
+              SetBox(Box(box_.pos_ + Vec2d(0, 10), box_.size_));
             }
           } else if (key == GLFW_KEY_LEFT) {
             if (!OutofWindow(Box(box_.pos_ - Vec2d(10, 0), box_.size_))) {
-              box_.pos_.x -= 10;
+              SetBox(Box(box_.pos_ - Vec2d(10, 0), box_.size_));
             }
           } else if (key == GLFW_KEY_RIGHT) {
             if (!OutofWindow(Box(box_.pos_ + Vec2d(10, 0), box_.size_))) {
-              box_.pos_.x += 10;
+              SetBox(Box(box_.pos_ + Vec2d(10, 0), box_.size_));
             }
           }
         }
@@ -325,8 +495,10 @@ class Component : public BoxedObj {
         if (key == GLFW_KEY_ENTER && action == GLFW_PRESS) {
           editstatus = WAITING;
           text_.status_ = TextInput::SHOW;
+          Invalidate();
         } else {
           text_.OnKeyboard(window, key, action, modifier);
+          Invalidate();
           return -2;
         }
       }
@@ -340,6 +512,7 @@ class Component : public BoxedObj {
     status = Status::UNSELECTED;
     text_.status_ = TextInput::SHOW;
     editstatus = WAITING;
+    Invalidate();
   }
 
   virtual bool IsArrow() { return false; }
@@ -347,6 +520,7 @@ class Component : public BoxedObj {
   virtual void OnCharEvent(unsigned codepoint) {
     if (editstatus == EDITING) {
       text_.OnChar(codepoint);
+      Invalidate();
     }
   }
 
@@ -39,45 +39,45 @@ class CondBlock : public Component {
 
   TextInput left, right;
 
-  virtual void Render(QuadTreeNode* node, double w, double h) override {
-    UpdateSize(w, h);
+  virtual void SetTextAtlas(TextAtlas* atlas) override {
+    Component::SetTextAtlas(atlas);
+    left.SetAtlas(atlas);
+    right.SetAtlas(atlas);
+  }
 
-    // RenderPorts(w, h);
-    Box box = box_;
-    SkPaint paint;
+  virtual void SetStrokeBatch(StrokeBatch* batch) override {
+    Component::SetStrokeBatch(batch);
+    left.batch_ = batch;
+    right.batch_ = batch;
+  }
 
-    Vec2d mid = box.Mid();
+  virtual void SetShapeCache(ShapeCache* shapes) override {
+    Component::SetShapeCache(shapes);
+    left.SetShapeCache(shapes);
+    right.SetShapeCache(shapes);
+  }
 
-    paint.setStyle(SkPaint::kStroke_Style);
-    paint.setAntiAlias(true);
-    paint.setStrokeWidth(2);
-    if (status == Status::SELECTED || status == Status::MOVING ||
-        status == Status::ZOOMING || status == Status::EDITING) {
-      paint.setColor(SK_ColorBLUE);
-      (*canvas)->drawLine(mid.x, box.pos_.y, box.pos_.x, mid.y, paint);
-      (*canvas)->drawLine(box.pos_.x, mid.y, mid.x, box.pos_.y + box.size_.y,
-                          paint);
-      (*canvas)->drawLine(mid.x, box.pos_.y + box.size_.y,
-                          box.pos_.x + box.size_.x, mid.y, paint);
-      (*canvas)->drawLine(box.pos_.x + box.size_.x, mid.y, mid.x, box.pos_.y,
-                          paint);
-    } else {
-      paint.setColor(SK_ColorBLACK);
-      (*canvas)->drawLine(mid.x, box.pos_.y, box.pos_.x, mid.y, paint);
-      (*canvas)->drawLine(box.pos_.x, mid.y, mid.x, box.pos_.y + box.size_.y,
-                          paint);
-      (*canvas)->drawLine(mid.x, box.pos_.y + box.size_.y,
-                          box.pos_.x + box.size_.x, mid.y, paint);
-      (*canvas)->drawLine(box.pos_.x + box.size_.x, mid.y, mid.x, box.pos_.y,
-                          paint);
-    }
+  virtual void SetLod(const Lod* lod) override {
+    Component::SetLod(lod);
+    left.lod_ = lod;
+    right.lod_ = lod;
+  }
+
+  // 真假标签画在包围盒外侧
+  virtual Box GetDrawBound() override {
+    return right.JoinBound(left.JoinBound(Component::GetDrawBound()));
+  }
 
-    if (Selected()) {
-      float interval[] = {10, 20};
-      paint.setPathEffect(SkDashPathEffect::Make(interval, 2, 0.0f));
-      (*canvas)->drawRect(box_.GetEdge(), paint);
+  virtual void Render(SpatialIndex* node, double w, double h) override {
+    UpdateSize(w, h);
+    if (RenderGreeked()) {
+      return;
     }
 
+    RenderShape();
+
+    Box box = box_;
+    Vec2d mid = box.Mid();
     double textwidth = box_.size_.x - 30;
     double textheight = box_.size_.y - 30;
     Vec2d center = box_.Mid();
@@ -90,6 +90,18 @@ class CondBlock : public Component {
                        16, 16);
   }
 
+  virtual void BuildShape(SkPath* path) override {
+    Box box(Vec2d(0, 0), box_.size_);
+    Vec2d mid = box.Mid();
+    path->moveTo(mid.x, box.pos_.y);
+    path->lineTo(box.pos_.x, mid.y);
+    path->lineTo(mid.x, box.pos_.y + box.size_.y);
+    path->lineTo(box.pos_.x + box.size_.x, mid.y);
+    path->close();
+  }
+
+  virtual bool DashedFrame() override { return true; }
+
   virtual vector<Vec2d> GetLineIntersection(Vec2d p1, Vec2d p2) override {
     Box box = box_;
 
@@ -24,38 +24,13 @@ class IOBlock : public Component {
     ports_ = {Vec2d(0.4, 1), Vec2d(0.6, 0), Vec2d(0.1, 0.5), Vec2d(0.9, 0.5)};
   }
 
-  virtual void Render(QuadTreeNode* node, double w, double h) override {
+  virtual void Render(SpatialIndex* node, double w, double h) override {
     UpdateSize(w, h);
-
-    SkPaint paint;
-    paint.setStyle(SkPaint::kStroke_Style);
-    paint.setAntiAlias(true);
-    paint.setStrokeWidth(2);
-    if (Selected()) {
-      paint.setColor(SK_ColorBLUE);
-    } else {
-      paint.setColor(SK_ColorBLACK);
+    if (RenderGreeked()) {
+      return;
     }
 
-    (*canvas)->drawLine(box_.pos_.x + box_.size_.x * 0.2, box_.pos_.y,
-                        box_.pos_.x + box_.size_.x, box_.pos_.y, paint);
-
-    (*canvas)->drawLine(box_.pos_.x, box_.pos_.y + box_.size_.y,
-                        box_.pos_.x + box_.size_.x * 0.8,
-                        box_.pos_.y + box_.size_.y, paint);
-
-    (*canvas)->drawLine(box_.pos_.x + box_.size_.x * 0.2, box_.pos_.y,
-                        box_.pos_.x, box_.pos_.y + box_.size_.y, paint);
-
-    (*canvas)->drawLine(box_.pos_.x + box_.size_.x, box_.pos_.y,
-                        box_.pos_.x + box_.size_.x * 0.8,
-                        box_.pos_.y + box_.size_.y, paint);
-
-    if (Selected()) {
-      float interval[] = {10, 20};
-      paint.setPathEffect(SkDashPathEffect::Make(interval, 2, 0.0f));
-      (*canvas)->drawRect(box_.GetEdge(), paint);
-    }
+    RenderShape();
 
     double textwidth = box_.size_.x - 30;
     double textheight = box_.size_.y - 30;
@@ -64,6 +39,17 @@ class IOBlock : public Component {
                        textwidth, textheight);
   }
 
+  virtual void BuildShape(SkPath* path) override {
+    Box box(Vec2d(0, 0), box_.size_);
+    path->moveTo(box.pos_.x + box.size_.x * 0.2, box.pos_.y);
+    path->lineTo(box.pos_.x + box.size_.x, box.pos_.y);
+    path->lineTo(box.pos_.x + box.size_.x * 0.8, box.pos_.y + box.size_.y);
+    path->lineTo(box.pos_.x, box.pos_.y + box.size_.y);
+    path->close();
+  }
+
+  virtual bool DashedFrame() override { return true; }
+
   virtual vector<Vec2d> GetLineIntersection(Vec2d p1, Vec2d p2) override {
     vector<Vec2d> points = {
         Vec2d(box_.pos_.x + box_.size_.x * 0.2, box_.pos_.y),
@@ -11,6 +11,8 @@
 
 #pragma once
 
+#include <algorithm>
+#include <cmath>
 #include <cstddef>
 #include <functional>
 #include <memory>
@@ -22,10 +24,24 @@
 #include "component/process.h"
 #include "component/startblock.h"
 #include "component/subblock.h"
+#include "include/core/SkBBHFactory.h"
 #include "include/core/SkColor.h"
+#include "include/core/SkPictureRecorder.h"
+#include "include/core/SkStream.h"
+#include "include/core/SkRegion.h"
 #include "include/core/SkTypeface.h"
+#include "utils/aabbtree.h"
+#include "utils/cachedlayer.h"
+#include "utils/camera.h"
+#include "utils/damage.h"
 #include "utils/frame.h"
+#include "utils/grid.h"
+#include "utils/lod.h"
+#include "utils/minimaptiles.h"
 #include "utils/quadtree.h"
+#include "utils/shapecache.h"
+#include "utils/textatlas.h"
+#include "utils/tiledraster.h"
 
 // GLFW
 #include "GLFW/glfw3.h"
@@ -35,6 +51,7 @@
 #include "include/core/SkCanvas.h"
 #include "include/core/SkColorSpace.h"
 #include "include/core/SkSurface.h"
+#include "include/encode/SkPngEncoder.h"
 #include "include/gpu/GrBackendSurface.h"
 #include "include/gpu/GrDirectContext.h"
 #include "include/gpu/gl/GrGLInterface.h"
@@ -53,47 +70,158 @@ class UIManager {
     ARROW
   };
   WorkStatus workstatus_ = SELECTION;
+  // 空间索引须先于components构造、后于其析构
+  unique_ptr<SpatialIndex> index_;
+  SpatialIndex::Type index_type_;
+  // 所有文本框共用的图集，同样须先于components构造
+  TextAtlas atlas_;
+  // 所有文本框共用的排版缓存，许多组件含有相同的词语
+  ShapeCache shapes_;
+  // 重绘时合并所有组件的外形
+  StrokeBatch strokes_;
+  // 当前合并绘制的批次，画出队列后递增
+  uint64_t batch_id_ = 1;
   vector<shared_ptr<Component>> components;
 
   Component* selected_ = nullptr;
 
   GrDirectContext* context = nullptr;
 
+  // 组件绘制到离屏图层layer_上，canvas指向图层的画布；
+  // 交换缓冲后窗口后台缓冲区内容不确定，故每帧将图层整体贴到surface
   SkCanvas* canvas = nullptr;
   SkSurface* surface = nullptr;
+  sk_sp<SkSurface> layer_;
   sk_sp<SkTypeface> skface;
   SkFont font;
   hb_face_t* face = nullptr;
   hb_font_t* hb_font = nullptr;
   FrameCounter fc;
 
-  QuadTreeNode tree_;
-
   bool leftdown;
+  // 光标的屏幕坐标与对应的世界坐标
   Vec2d cursorpos;
+  Vec2d worldpos_;
+
+  // 组件使用世界坐标，经camera_变换到画布，侧边栏始终使用屏幕坐标
+  Camera camera_;
+  // 画布部分可见的世界坐标范围
+  Box view_;
+  // 按住右键拖动画面
+  bool panning_ = false;
+  // 随缩放变化的细节等级，所有组件共用
+  Lod lod_ = Lod::FULL;
+
+  // 右下角的小地图，由一层按文档尺寸选定分辨率的分块拼成，每帧只画几张图像；
+  // 分块按组件报告的世界坐标重绘区域增量更新，
+  // 至多每kMinimapInterval秒一次
+  MinimapTiles minimap_;
+  DamageTracker minimap_damage_;
+  bool minimap_stale_ = true;
+  double minimap_time_ = 0;
+  Box doc_bound_;
+  bool has_doc_bound_ = false;
+  static constexpr double kMinimapInterval = 0.25;
+  static constexpr int kMinimapWidth = 200;
+  static constexpr int kMinimapHeight = 150;
+  static constexpr int kMinimapMargin = 10;
+
+  // 需要重绘的区域，只有其中的组件会重新绘制
+  DamageTracker damage_;
+  // 本帧的重绘区域与需要重绘的组件，帧间复用
+  vector<Box> damage_rects_;
+  vector<Component*> redraw_;
+  vector<Box> world_rects_;
+  vector<Arrow*> arrows_;
+  // 组件绘制超出其包围盒的最大距离，查询重绘组件时向外扩展
+  static constexpr double kMaxOverhang = 40;
+  double overhang_ = kMaxOverhang;
+  // 上次绘制侧边栏时的工作状态
+  WorkStatus sidebar_status_ = SELECTION;
+  // 侧边栏只随工作状态与窗口高度变化
+  CachedLayer sidebar_;
+  static constexpr int kSidebarWidth = 101;
+  // 软件光栅化时分块并行绘制，GL后端下为空
+  unique_ptr<TiledRasterizer> tiler_;
+
+  // 拖动或缩放组件时其余画面不变，将除活动组件及其箭头外的画面存为背景，
+  // 拖动期间只画背景与活动的组件，代价与图中组件总数无关
+  Component* dragging_ = nullptr;
+  vector<Component*> drag_items_;
+  sk_sp<SkImage> drag_background_;
+
+  enum PaintMode { ALL, DRAG_ITEMS, EXCEPT_DRAG_ITEMS };
+
+  // GL使用窗口的默认帧缓冲，RASTER在内存中绘制，不需要窗口与GPU
+  enum class Backend { GL, RASTER };
+  Backend backend_ = Backend::GL;
 
   void InitSkia(int w, int h) {
     auto interface = GrGLMakeNativeInterface();
     context = GrDirectContext::MakeGL(interface).release();
+    backend_ = Backend::GL;
+    MakeSurface(w, h);
+    MakeLayer(w, h);
+    atlas_.context_ = context;
+    minimap_.context_ = context;
+    InitFont();
+  }
+
+  // 无显示器时使用，例如批量导出、生成缩略图与在CI上测试性能
+  void InitRaster(int w, int h) {
+    context = nullptr;
+    backend_ = Backend::RASTER;
+    width = w;
+    height = h;
+    UpdateView();
+    MakeSurface(w, h);
+    MakeLayer(w, h);
+    atlas_.context_ = nullptr;
+    minimap_.context_ = nullptr;
+    tiler_ = make_unique<TiledRasterizer>();
+    InitFont();
+  }
 
-    GrGLFramebufferInfo framebufferInfo;
-    framebufferInfo.fFBOID = 0;  // assume default framebuffer
-    framebufferInfo.fFormat = GL_RGBA8;
-
-    SkColorType colorType = kRGBA_8888_SkColorType;
-    GrBackendRenderTarget backendRenderTarget(w, h,
-                                              0,  // sample count
-                                              0,  // stencil bits
-                                              framebufferInfo);
-    surface = SkSurface::MakeFromBackendRenderTarget(
-                  context, backendRenderTarget, kBottomLeft_GrSurfaceOrigin,
-                  colorType, nullptr, nullptr)
-                  .release();
+  void MakeSurface(int w, int h) {
+    delete surface;
+    if (backend_ == Backend::RASTER) {
+      surface =
+          SkSurface::MakeRaster(SkImageInfo::MakeN32Premul(w, h)).release();
+    } else {
+      GrGLFramebufferInfo framebufferInfo;
+      framebufferInfo.fFBOID = 0;  // assume default framebuffer
+      framebufferInfo.fFormat = GL_RGBA8;
+
+      SkColorType colorType = kRGBA_8888_SkColorType;
+      GrBackendRenderTarget backendRenderTarget(w, h,
+                                                0,  // sample count
+                                                0,  // stencil bits
+                                                framebufferInfo);
+      surface = SkSurface::MakeFromBackendRenderTarget(
+                    context, backendRenderTarget, kBottomLeft_GrSurfaceOrigin,
+                    colorType, nullptr, nullptr)
+                    .release();
+    }
     if (surface == nullptr) {
       abort();
     }
-    canvas = surface->getCanvas();
-    InitFont();
+  }
+
+  // 重新创建离屏图层，整个窗口都需要重绘
+  void MakeLayer(int w, int h) {
+    SkImageInfo info = SkImageInfo::MakeN32Premul(w, h);
+    layer_ = context != nullptr
+                 ? SkSurface::MakeRenderTarget(context, SkBudgeted::kNo, info)
+                 : SkSurface::MakeRaster(info);
+    if (layer_ == nullptr) {
+      abort();
+    }
+    canvas = layer_->getCanvas();
+    dragging_ = nullptr;
+    drag_items_.clear();
+    drag_background_ = nullptr;
+    damage_.Clear();
+    damage_.Add(Box(Vec2d(0, 0), Vec2d(w, h)));
   }
 
   void InitFont() {
@@ -114,8 +242,18 @@ class UIManager {
   }
 
   void Close() {
+    // 缓存以字体指针为键，字体释放后不再有效
+    shapes_.Clear();
     hb_font_destroy(hb_font);
     hb_face_destroy(face);
+    sidebar_.Reset();
+    atlas_.Reset();
+    minimap_.Reset();
+    minimap_stale_ = true;
+    has_doc_bound_ = false;
+    tiler_ = nullptr;
+    atlas_.context_ = nullptr;
+    layer_ = nullptr;
     delete surface;
     surface = nullptr;
     delete context;
@@ -126,19 +264,35 @@ class UIManager {
   void AddComponent(shared_ptr<Component> component) {
     components.push_back(component);
     component->depth_ = components.size();
+    component->damage_ = &damage_;
+    component->SetTextAtlas(&atlas_);
+    component->SetStrokeBatch(&strokes_);
+    component->view_ = &view_;
+    component->SetLod(&lod_);
+    component->SetShapeCache(&shapes_);
+    index_->Insert(component.get());
     UpdateDepth();
+    component->Invalidate();
   }
 
   void DelComponent(Component* c) {
+    // 背景中可能含有被删除的组件
+    dragging_ = nullptr;
+    drag_items_.clear();
+    drag_background_ = nullptr;
     for (auto i = components.begin(); i != components.end();) {
       if ((*i)->IsArrow() && !(c->IsArrow())) {
         Arrow* arrow = (Arrow*)i->get();
         if (arrow->start_ == c || arrow->end_ == c) {
+          arrow->Invalidate();
+          index_->Remove(i->get());
           i = components.erase(i);
           continue;
         }
       }
       if (i->get() == c) {
+        c->Invalidate();
+        index_->Remove(i->get());
         i = components.erase(i);
         continue;
       }
@@ -155,91 +309,644 @@ class UIManager {
 
   double width, height;
 
-  UIManager(double w, double h)
-      : tree_(Box(Vec2d(0, 0), Vec2d(w, h))), width(w), height(h) {
+  UIManager(double w, double h,
+            SpatialIndex::Type type = SpatialIndex::Type::QUADTREE)
+      : index_(MakeIndex(type, w, h)),
+        index_type_(type),
+        width(w),
+        height(h) {
+    damage_.camera_ = &camera_;
+    damage_.world_ = &minimap_damage_;
+    UpdateView();
     // InitSkia(width, height);
   }
 
-  void ProcessFrame(double w, double h) {
-    tree_.Clear();
-    tree_.bound_ = Box(Vec2d(0, 0), Vec2d(w, h));
-    for (auto& i : components) {
-      tree_.Insert(i.get());
-    }
+  void UpdateView() {
+    view_ = camera_.ToWorld(Box(Vec2d(100, 0), Vec2d(width - 100, height)));
+  }
 
-    if (w != width || h != height) {
-      OnWindowSizeChange(w, h);
+  // 视图变换改变后画面整体移动，全部重绘
+  void OnCameraChange() {
+    UpdateView();
+    lod_ = LodForScale(camera_.scale_);
+    worldpos_ = camera_.ToWorld(cursorpos);
+    dragging_ = nullptr;
+    drag_items_.clear();
+    drag_background_ = nullptr;
+    damage_.Add(Box(Vec2d(0, 0), Vec2d(width, height)));
+  }
+
+  void SetCamera(Vec2d offset, double scale) {
+    camera_.offset_ = offset;
+    camera_.scale_ = clamp(scale, Camera::kMinScale, Camera::kMaxScale);
+    OnCameraChange();
+  }
+
+  // 滚轮以光标为中心缩放画布
+  void OnScrollEvent(double xoffset, double yoffset) {
+    if (cursorpos.x <= 100 || yoffset == 0) {
+      return;
     }
+    camera_.ZoomAt(cursorpos, pow(1.1, yoffset));
+    OnCameraChange();
+  }
 
-    SkPaint paint;
-    paint.setColor(SK_ColorWHITE);
-    canvas->drawPaint(paint);
+  static unique_ptr<SpatialIndex> MakeIndex(SpatialIndex::Type type, double w,
+                                            double h) {
+    switch (type) {
+      case SpatialIndex::Type::GRID:
+        return make_unique<UniformGrid>();
+      case SpatialIndex::Type::BVH:
+        return make_unique<AabbTree>();
+      default:
+        return make_unique<QuadTree>(Box(Vec2d(0, 0), Vec2d(w, h)));
+    }
+  }
 
-    paint.setColor(SK_ColorBLACK);
+  // 更换空间索引的实现，已有组件批量建入新的索引
+  void SetIndexType(SpatialIndex::Type type) {
+    index_ = MakeIndex(type, width, height);
+    index_type_ = type;
+    RebuildTree();
+  }
 
-    canvas->drawLine(100, 0, 100, h, paint);
+  // 目前只有四叉树支持按查询统计自动调整
+  void SetAutoTune(bool on) {
+    if (index_type_ == SpatialIndex::Type::QUADTREE) {
+      ((QuadTree*)index_.get())->auto_tune_ = on;
+    }
+  }
 
+  // 空间索引在帧间保持并随组件自动扩展，不再随窗口大小重建
+  void RebuildTree() {
+    vector<BoxedObj*> objs;
+    objs.reserve(components.size());
     for (auto& i : components) {
-      i->Render(&tree_, w, h);
+      objs.push_back(i.get());
+    }
+    index_->Build(objs);
+  }
+
+  // 载入或生成大量组件时使用，一次性批量建树而非逐个插入
+  void AddComponents(const vector<shared_ptr<Component>>& cs) {
+    components.insert(components.end(), cs.begin(), cs.end());
+    for (auto& i : cs) {
+      i->damage_ = &damage_;
+      i->SetTextAtlas(&atlas_);
+      i->SetStrokeBatch(&strokes_);
+      i->view_ = &view_;
+      i->SetLod(&lod_);
+      i->SetShapeCache(&shapes_);
+      minimap_damage_.Add(i->GetDrawBound());
+    }
+    UpdateDepth();
+    RebuildTree();
+    damage_.Add(Box(Vec2d(0, 0), Vec2d(width, height)));
+  }
+
+  void ProcessFrame(double w, double h) {
+    if (w != width || h != height) {
+      OnWindowSizeChange(w, h);
     }
+    index_->Maintain();
 
+    if (selected_ != nullptr) {
+      selected_->Tick(Now());
+    }
+    if (sidebar_status_ != workstatus_) {
+      damage_.Add(Box(Vec2d(0, 0), Vec2d(kSidebarWidth, h)));
+      sidebar_status_ = workstatus_;
+    }
+    UpdateArrows();
+    UpdateDragLayer(w, h);
+    if (!damage_.Empty()) {
+      RepaintDamage(w, h);
+    }
+    UpdateMinimap(Now());
+    layer_->draw(surface->getCanvas(), 0, 0);
+
+    // 跟随光标的预览图形每帧都变，直接画在窗口上而不进入图层
+    SkCanvas* screen = surface->getCanvas();
     if (cursorpos.x > 100) {
+      screen->save();
+      camera_.Apply(screen);
       if (workstatus_ == PROCESSBLOCK) {
-        DrawProcessBlock(cursorpos.x, cursorpos.y);
+        DrawProcessBlock(screen, worldpos_.x, worldpos_.y);
       } else if (workstatus_ == STARTBLOCK) {
-        DrawStartBlock(cursorpos.x, cursorpos.y);
+        DrawStartBlock(screen, worldpos_.x, worldpos_.y);
       } else if (workstatus_ == IOBLOCK) {
-        DrawIOBlock(cursorpos.x, cursorpos.y);
+        DrawIOBlock(screen, worldpos_.x, worldpos_.y);
       } else if (workstatus_ == SUBBLOCK) {
-        DrawSubBlock(cursorpos.x, cursorpos.y);
+        DrawSubBlock(screen, worldpos_.x, worldpos_.y);
       } else if (workstatus_ == CONDBLOCK) {
-        DrawCondBlock(cursorpos.x, cursorpos.y);
+        DrawCondBlock(screen, worldpos_.x, worldpos_.y);
       }
+      screen->restore();
     }
+    DrawMinimap(screen);
 
-    DrawSidebar(w, h);
-
-    context->flush();
+    if (context != nullptr) {
+      context->flush();
+    }
     fc.RenderFrame();
   }
 
+  // 绘制一帧并返回画面，不含跟随光标的预览图形
+  sk_sp<SkImage> Snapshot() {
+    ProcessFrame(width, height);
+    return layer_->makeImageSnapshot();
+  }
+
+  // 无窗口导出：在w×h的内存画面上由build添加组件，
+  // 视图缩放到容纳全部组件后保存为PNG
+  bool ExportDocument(const char* path, int w, int h,
+                      const function<void(UIManager&)>& build) {
+    InitRaster(w, h);
+    if (build) {
+      build(*this);
+    }
+    FitDocument();
+    bool ok = ExportPNG(path);
+    Close();
+    return ok;
+  }
+
+  // 调整视图使全部组件位于画布中，没有组件时不变
+  void FitDocument() {
+    if (components.empty()) {
+      return;
+    }
+    Box bound = DocumentBound();
+    Box area(Vec2d(100, 0), Vec2d(width - 100, height));
+    double scale = min(area.size_.x / max(bound.size_.x, 1.0),
+                       area.size_.y / max(bound.size_.y, 1.0));
+    scale = clamp(scale, Camera::kMinScale, 1.0);
+    Vec2d mid = bound.Mid(), center = area.Mid();
+    SetCamera(Vec2d(mid.x - center.x / scale, mid.y - center.y / scale),
+              scale);
+  }
+
+  // 将当前画面保存为PNG
+  bool ExportPNG(const char* path) {
+    sk_sp<SkImage> image = Snapshot();
+    if (image == nullptr) {
+      return false;
+    }
+    // GPU上的图像需先读回内存
+    image = image->makeRasterImage();
+    SkPixmap pixmap;
+    if (image == nullptr || !image->peekPixels(&pixmap)) {
+      return false;
+    }
+    SkFILEWStream stream(path);
+    return SkPngEncoder::Encode(&stream, pixmap, {});
+  }
+
+  // 距下次需要绘制的秒数，0表示有待重绘的内容，负数表示只需等待输入
+  double FrameTimeout(double now) {
+    if (!damage_.Empty()) {
+      return 0;
+    }
+    double res = -1;
+    if (selected_ != nullptr && selected_->text_.status_ == TextInput::EDIT) {
+      if (selected_->text_.BlinkDue(now)) {
+        return 0;
+      }
+      res = selected_->text_.NextBlink(now) - now;
+    }
+    if (MinimapPending()) {
+      double t = max(0.0, minimap_time_ + kMinimapInterval - now);
+      res = res < 0 ? t : min(res, t);
+    }
+    return res;
+  }
+
+  bool MinimapPending() { return minimap_stale_ || !minimap_damage_.Empty(); }
+
+  // 文档中所有组件的范围
+  Box DocumentBound() {
+    if (components.empty()) {
+      return Box(view_.Mid(), Vec2d(0, 0));
+    }
+    Box res = components[0]->GetDrawBound();
+    for (auto& i : components) {
+      res = res.Join(i->GetDrawBound());
+    }
+    return res;
+  }
+
+  // 将积累的重绘区域交给小地图分块，重建变脏的部分
+  void UpdateMinimap(double now) {
+    if (!MinimapPending() || now - minimap_time_ < kMinimapInterval) {
+      return;
+    }
+    minimap_time_ = now;
+    UpdateDocBound();
+    for (auto& r : minimap_damage_.rects_) {
+      minimap_.MarkDirty(r);
+    }
+    minimap_damage_.Clear();
+    minimap_stale_ = false;
+    minimap_.Update(doc_bound_, kMinimapWidth, kMinimapHeight,
+                    [this](SkCanvas* c, const Box& world) {
+                      PaintMinimapTile(c, world);
+                    });
+  }
+
+  // 按世界坐标的重绘区域增量维护文档范围。超出范围的区域只能是组件的新位置，
+  // 直接合并；落在范围内却贴着边界的可能是移走或删除的组件，才重新遍历
+  void UpdateDocBound() {
+    if (components.empty()) {
+      doc_bound_ = DocumentBound();
+      has_doc_bound_ = false;
+      return;
+    }
+    bool shrink = !has_doc_bound_;
+    Box grown = doc_bound_;
+    Vec2d lo = doc_bound_.pos_, hi = doc_bound_.pos_ + doc_bound_.size_;
+    for (auto& r : minimap_damage_.rects_) {
+      Vec2d end = r.pos_ + r.size_;
+      if (!SpatialIndex::InBound(doc_bound_, r)) {
+        grown = grown.Join(r);
+      } else if (r.pos_.x <= lo.x || r.pos_.y <= lo.y || end.x >= hi.x ||
+                 end.y >= hi.y) {
+        shrink = true;
+      }
+    }
+    doc_bound_ = shrink ? DocumentBound() : grown;
+    has_doc_bound_ = true;
+  }
+
+  // 以远景细节在c上绘制world内的组件，不改变主画面的重绘状态
+  void PaintMinimapTile(SkCanvas* c, const Box& world) {
+    redraw_.clear();
+    index_->QueryOverlap(world.Outset(overhang_), [this](BoxedObj* obj) {
+      redraw_.push_back((Component*)obj);
+      return true;
+    });
+    sort(redraw_.begin(), redraw_.end(),
+         [](Component* a, Component* b) { return a->depth_ < b->depth_; });
+    SkCanvas* saved = canvas;
+    Lod saved_lod = lod_;
+    canvas = c;
+    lod_ = Lod::GREEK;
+    // 与主画面相同，在层次交界处先画出已排队的外形
+    strokes_.Begin();
+    for (auto i : redraw_) {
+      FlushBatchUnder(i, i->GetDrawBound());
+      i->Render(index_.get(), width, height);
+      i->batch_mark_ = batch_id_;
+    }
+    FlushBatch();
+    canvas = saved;
+    lod_ = saved_lod;
+  }
+
+  SkRect MinimapRect() {
+    return SkRect::MakeXYWH(width - kMinimapWidth - kMinimapMargin,
+                            height - kMinimapHeight - kMinimapMargin,
+                            kMinimapWidth, kMinimapHeight);
+  }
+
+  // 小地图显示的世界范围，包含文档与当前视图，按小地图的长宽比扩展
+  Box MinimapSource() {
+    Box b = doc_bound_.Join(view_);
+    double scale = min(kMinimapWidth / b.size_.x, kMinimapHeight / b.size_.y);
+    Vec2d size(kMinimapWidth / scale, kMinimapHeight / scale);
+    return Box(b.Mid() - size / 2.0, size);
+  }
+
+  bool InMinimap(Vec2d p) {
+    SkRect r = MinimapRect();
+    return p.x >= r.x() && p.x < r.x() + r.width() && p.y >= r.y() &&
+           p.y < r.y() + r.height();
+  }
+
+  void DrawMinimap(SkCanvas* c) {
+    SkRect dst = MinimapRect();
+    Box src = MinimapSource();
+    SkPaint paint;
+    paint.setColor(SK_ColorWHITE);
+    c->drawRect(dst, paint);
+    minimap_.Draw(c, src, dst);
+
+    double scale = kMinimapWidth / src.size_.x;
+    SkRect view =
+        SkRect::MakeXYWH(dst.x() + (view_.pos_.x - src.pos_.x) * scale,
+                         dst.y() + (view_.pos_.y - src.pos_.y) * scale,
+                         view_.size_.x * scale, view_.size_.y * scale);
+    paint.setStyle(SkPaint::kStroke_Style);
+    paint.setStrokeWidth(1);
+    paint.setColor(SK_ColorBLUE);
+    c->save();
+    c->clipRect(dst);
+    c->drawRect(view, paint);
+    c->restore();
+    paint.setColor(SK_ColorBLACK);
+    c->drawRect(dst, paint);
+  }
+
+  // 点击小地图时将视图中心移到对应位置
+  void JumpToMinimap(Vec2d p) {
+    SkRect dst = MinimapRect();
+    Box src = MinimapSource();
+    double scale = kMinimapWidth / src.size_.x;
+    Vec2d world(src.pos_.x + (p.x - dst.x()) / scale,
+                src.pos_.y + (p.y - dst.y()) / scale);
+    Vec2d center((100 + width) / 2.0, height / 2.0);
+    SetCamera(Vec2d(world.x - center.x / camera_.scale_,
+                    world.y - center.y / camera_.scale_),
+              camera_.scale_);
+  }
+
+  // 端点所连组件移动后箭头须跟着移动，此类箭头必与重绘区域相交，
+  // 在查询结束后再更新以免查询中修改索引
+  void UpdateArrows() {
+    arrows_.clear();
+    damage_rects_ = damage_.rects_;
+    for (auto& r : damage_rects_) {
+      index_->QueryOverlap(camera_.ToWorld(r), [this](BoxedObj* obj) {
+        Component* c = (Component*)obj;
+        if (c->IsArrow()) {
+          arrows_.push_back((Arrow*)c);
+        }
+        return true;
+      });
+    }
+    for (auto i : arrows_) {
+      i->UpdateGeometry();
+    }
+  }
+
+  // 活动组件开始或结束拖动时建立或丢弃背景
+  void UpdateDragLayer(double w, double h) {
+    Component* active = nullptr;
+    if (selected_ != nullptr &&
+        (selected_->status == Component::Status::MOVING ||
+         selected_->status == Component::Status::ZOOMING)) {
+      active = selected_;
+    }
+    if (active == dragging_) {
+      return;
+    }
+    // 拖动期间被活动组件遮挡的箭头等不会更新，结束时按常规方式补画
+    if (dragging_ != nullptr) {
+      dragging_->Invalidate();
+    }
+    dragging_ = active;
+    drag_items_.clear();
+    drag_background_ = nullptr;
+    if (active == nullptr) {
+      return;
+    }
+    drag_items_.push_back(active);
+    for (auto& i : components) {
+      if (i->IsArrow()) {
+        Arrow* arrow = (Arrow*)i.get();
+        if (arrow->start_ == active || arrow->end_ == active) {
+          drag_items_.push_back(arrow);
+        }
+      }
+    }
+
+    // 在当前画面上擦去活动的组件，并补画尚未绘制的重绘区域
+    vector<Box> rects = damage_.rects_;
+    for (auto i : drag_items_) {
+      if (i->drawn_) {
+        rects.push_back(camera_.ToScreen(i->last_drawn_));
+      }
+    }
+    SkImageInfo info = SkImageInfo::MakeN32Premul(w, h);
+    sk_sp<SkSurface> background =
+        context != nullptr
+            ? SkSurface::MakeRenderTarget(context, SkBudgeted::kNo, info)
+            : SkSurface::MakeRaster(info);
+    if (background == nullptr) {
+      dragging_ = nullptr;
+      drag_items_.clear();
+      return;
+    }
+    layer_->draw(background->getCanvas(), 0, 0);
+    SkCanvas* saved = canvas;
+    canvas = background->getCanvas();
+    PaintRegion(rects, w, h, EXCEPT_DRAG_ITEMS, nullptr);
+    canvas = saved;
+    drag_background_ = background->makeImageSnapshot();
+  }
+
+  // 将重绘区域设为裁剪区域，清空后按深度重绘与之相交的组件
+  void RepaintDamage(double w, double h) {
+    // 窗口外的世界无需绘制，查询范围也因此限于可见部分
+    Box window(Vec2d(0, 0), Vec2d(w, h));
+    damage_rects_.clear();
+    for (auto& r : damage_.rects_) {
+      Box clipped = r.Intersect(window);
+      if (clipped.size_.x > 0 && clipped.size_.y > 0) {
+        damage_rects_.push_back(clipped);
+      }
+    }
+    damage_.Clear();
+
+    // 分块绘制时先将本帧录制下来，组件经canvas绘制，故只需临时替换canvas；
+    // 录制时建立R树，回放各块时跳过块外的绘制命令
+    SkPictureRecorder recorder;
+    SkRTreeFactory rtree;
+    if (tiler_ != nullptr) {
+      canvas = recorder.beginRecording(SkRect::MakeWH(w, h), &rtree);
+    }
+
+    // 绘制后文字等范围可能改变，超出本次裁剪的部分留到下一帧
+    DamageTracker pending;
+    PaintRegion(damage_rects_, w, h,
+                drag_background_ != nullptr ? DRAG_ITEMS : ALL, &pending);
+
+    if (tiler_ != nullptr) {
+      canvas = layer_->getCanvas();
+      // 直接写像素前先让图层脱离尚在使用的快照
+      layer_->notifyContentWillChange(SkSurface::kRetain_ContentChangeMode);
+      SkPixmap pixmap;
+      if (layer_->peekPixels(&pixmap)) {
+        tiler_->Draw(pixmap, recorder.finishRecordingAsPicture(),
+                     damage_rects_);
+      }
+    }
+
+    for (auto& r : pending.rects_) {
+      damage_.Add(r);
+    }
+  }
+
+  // 在canvas上重绘rects(屏幕坐标)覆盖的区域，
+  // 绘制范围改变且超出rects的组件记入pending
+  void PaintRegion(const vector<Box>& rects, double w, double h,
+                   PaintMode mode, DamageTracker* pending) {
+    SkRegion region;
+    for (auto& r : rects) {
+      region.op(r.GetEdge().roundOut(), SkRegion::kUnion_Op);
+    }
+    canvas->save();
+    canvas->clipRegion(region);
+
+    // 只查询与可见的重绘区域相交的组件，不可见的组件不会绘制
+    world_rects_.clear();
+    for (auto& r : rects) {
+      world_rects_.push_back(camera_.ToWorld(r));
+    }
+    redraw_.clear();
+    if (mode == DRAG_ITEMS) {
+      canvas->drawImage(drag_background_, 0, 0);
+      redraw_ = drag_items_;
+    } else {
+      canvas->clear(SK_ColorWHITE);
+      for (auto& r : world_rects_) {
+        index_->QueryOverlap(r.Outset(overhang_), [this](BoxedObj* obj) {
+          redraw_.push_back((Component*)obj);
+          return true;
+        });
+      }
+      if (mode == EXCEPT_DRAG_ITEMS) {
+        erase_if(redraw_, [this](Component* c) {
+          return find(drag_items_.begin(), drag_items_.end(), c) !=
+                 drag_items_.end();
+        });
+      }
+    }
+    sort(redraw_.begin(), redraw_.end(),
+         [](Component* a, Component* b) { return a->depth_ < b->depth_; });
+    redraw_.erase(unique(redraw_.begin(), redraw_.end()), redraw_.end());
+
+    canvas->save();
+    camera_.Apply(canvas);
+    strokes_.Begin();
+    for (auto i : redraw_) {
+      bool hit = false;
+      Box bound = i->GetDrawBound();
+      for (auto& r : world_rects_) {
+        if (r.Overlaps(bound)) {
+          hit = true;
+          break;
+        }
+      }
+      if (!hit) {
+        continue;
+      }
+      FlushBatchUnder(i, bound);
+      i->Render(index_.get(), w, h);
+      i->batch_mark_ = batch_id_;
+      Box drawn = i->GetDrawBound();
+      if (!(drawn == bound) && pending != nullptr) {
+        bool covered = false;
+        for (auto& r : world_rects_) {
+          if (SpatialIndex::InBound(r, drawn)) {
+            covered = true;
+            break;
+          }
+        }
+        if (!covered) {
+          pending->AddWorld(drawn);
+        }
+      }
+      i->last_drawn_ = drawn;
+      i->drawn_ = true;
+      overhang_ = max(overhang_, i->box_.pos_.x - drawn.pos_.x);
+      overhang_ = max(overhang_, i->box_.pos_.y - drawn.pos_.y);
+      overhang_ = max(overhang_, drawn.pos_.x + drawn.size_.x -
+                                     i->box_.pos_.x - i->box_.size_.x);
+      overhang_ = max(overhang_, drawn.pos_.y + drawn.size_.y -
+                                     i->box_.pos_.y - i->box_.size_.y);
+    }
+
+    FlushBatch();
+    atlas_.NextFrame();
+    canvas->restore();
+    // 拖动时侧边栏已在背景中
+    if (mode != DRAG_ITEMS) {
+      Box sidebar(Vec2d(0, 0), Vec2d(kSidebarWidth, h));
+      for (auto& r : rects) {
+        if (r.Overlaps(sidebar)) {
+          DrawSidebar(w, h);
+          break;
+        }
+      }
+    }
+    canvas->restore();
+  }
+
+  // 合并绘制把外形与文字推迟到批次末尾，c与本批已排队的组件重叠时
+  // 先画出队列，使上层组件仍遮住下层的外形与文字
+  void FlushBatchUnder(Component* c, const Box& bound) {
+    bool overlap = false;
+    index_->QueryOverlap(bound.Outset(overhang_), [&](BoxedObj* obj) {
+      Component* o = (Component*)obj;
+      if (o != c && o->batch_mark_ == batch_id_ &&
+          o->GetDrawBound().Overlaps(bound)) {
+        overlap = true;
+        return false;
+      }
+      return true;
+    });
+    if (overlap) {
+      FlushBatch();
+      strokes_.Begin();
+    }
+  }
+
+  // 在canvas上画出排队的外形与文字，开始新的批次
+  void FlushBatch() {
+    strokes_.Flush(canvas);
+    atlas_.Flush(canvas);
+    ++batch_id_;
+  }
+
+  // 返回查询范围内包含光标且最上层的组件，不分配内存
+  // 箭头在距线段5像素内即算命中，故查询范围向外扩展5像素
+  Component* HitTest(Box range) {
+    Component* hit = nullptr;
+    Box point(worldpos_, Vec2d(0, 0));
+    range.pos_ = range.pos_ - Vec2d(5, 5);
+    range.size_ = range.size_ + Vec2d(10, 10);
+    index_->QueryOverlap(range, [&](BoxedObj* obj) {
+      Component* c = (Component*)obj;
+      if (c->IsCollided(point) && (hit == nullptr || c->depth_ > hit->depth_)) {
+        hit = c;
+      }
+      return true;
+    });
+    return hit;
+  }
+
   void OnCursorEvent(double xpos, double ypos) {
-    Vec2d velocity = (Vec2d(xpos, ypos) - cursorpos).Abs();
+    Vec2d delta = Vec2d(xpos, ypos) - cursorpos;
     cursorpos = Vec2d(xpos, ypos);
+    if (panning_) {
+      camera_.Pan(delta);
+      OnCameraChange();
+      return;
+    }
+    // 组件收到的坐标与速度均为世界坐标
+    Vec2d velocity = delta.Abs() * (1 / camera_.scale_);
+    worldpos_ = camera_.ToWorld(cursorpos);
+    xpos = worldpos_.x;
+    ypos = worldpos_.y;
     if (cursorpos.x > 100) {
       if (workstatus_ == SELECTION) {
         if (selected_ != nullptr) {
           if (selected_->status == Component::Status::MOVING ||
               selected_->status == Component::Status::ZOOMING) {
-            selected_->CursorEvent(&tree_, leftdown, xpos, ypos, velocity * 2);
+            selected_->CursorEvent(index_.get(), leftdown, xpos, ypos,
+                                   velocity * 2);
             return;
           }
         }
-        auto t = tree_.Retrieve(Box(cursorpos - velocity, velocity * 2));
-        if (t.size() != 0) {
-          vector<int> collided_index;
-          for (int i = 0; i < t.size(); ++i) {
-            Component* ti = (Component*)t[i];
-            if (ti->IsCollided(Box(cursorpos, Vec2d(0, 0)))) {
-              collided_index.push_back(i);
-            }
-          }
-          UpdateDepth();
-          if (!collided_index.empty()) {
-            int m = -1;
-            for (int i = 0; i < collided_index.size(); ++i) {
-              Component* ti = (Component*)t[i];
-              if (ti->depth_ > m) {
-                m = i;
-              }
-            }
-            Component* ti = (Component*)t[collided_index[m]];
-            ti->CursorEvent(&tree_, leftdown, xpos, ypos, velocity);
-          }
+        UpdateDepth();
+        Component* ti = HitTest(Box(worldpos_ - velocity, velocity * 2));
+        if (ti != nullptr) {
+          ti->CursorEvent(index_.get(), leftdown, xpos, ypos, velocity);
         }
       } else if (workstatus_ == ARROW) {
         if (selected_ != nullptr) {
-          selected_->CursorEvent(&tree_, leftdown, xpos, ypos, velocity * 2);
+          selected_->CursorEvent(index_.get(), leftdown, xpos, ypos,
+                                 velocity * 2);
         } else {
           if (leftdown) {
             auto arrow = make_shared<Arrow>(
@@ -249,14 +956,15 @@ class UIManager {
               selected_->Unselect();
             }
             selected_ = arrow.get();
-            arrow->CursorEvent(&tree_, leftdown, xpos, ypos, velocity * 2);
+            arrow->CursorEvent(index_.get(), leftdown, xpos, ypos,
+                               velocity * 2);
           }
         }
       }
     }
   }
 
-  void DrawProcessBlock(double xpos, double ypos) {
+  void DrawProcessBlock(SkCanvas* canvas, double xpos, double ypos) {
     SkPaint paint;
     paint.setStyle(SkPaint::kStroke_Style);
     paint.setAntiAlias(true);
@@ -266,7 +974,7 @@ class UIManager {
     canvas->drawRect(box.GetEdge(), paint);
   }
 
-  void DrawStartBlock(double xpos, double ypos) {
+  void DrawStartBlock(SkCanvas* canvas, double xpos, double ypos) {
     Box box = Box(Vec2d(xpos, ypos) - Vec2d(75, 50), Vec2d(150, 100));
     SkPaint paint;
 
@@ -297,7 +1005,7 @@ class UIManager {
                        box.pos_.y + box.size_.y, paint);
   }
 
-  void DrawIOBlock(double xpos, double ypos) {
+  void DrawIOBlock(SkCanvas* canvas, double xpos, double ypos) {
     Box box_ = Box(Vec2d(xpos, ypos) - Vec2d(75, 50), Vec2d(150, 100));
 
     SkPaint paint;
@@ -320,7 +1028,7 @@ class UIManager {
                        box_.pos_.y + box_.size_.y, paint);
   }
 
-  void DrawSubBlock(double xpos, double ypos) {
+  void DrawSubBlock(SkCanvas* canvas, double xpos, double ypos) {
     Box box_ = Box(Vec2d(xpos, ypos) - Vec2d(75, 50), Vec2d(150, 100));
     SkPaint paint;
     paint.setStyle(SkPaint::kStroke_Style);
@@ -335,7 +1043,7 @@ class UIManager {
                        box_.pos_.y + box_.size_.y, paint);
   }
 
-  void DrawCondBlock(double xpos, double ypos) {
+  void DrawCondBlock(SkCanvas* canvas, double xpos, double ypos) {
     Box box = Box(Vec2d(xpos, ypos) - Vec2d(75, 50), Vec2d(150, 100));
     SkPaint paint;
 
@@ -355,6 +1063,14 @@ class UIManager {
   }
 
   void OnButtonEvent(int button, int type) {
+    // 小地图上的点击只用于导航，不传给组件
+    if (button == 0 && InMinimap(cursorpos)) {
+      if (type == 1) {
+        JumpToMinimap(cursorpos);
+      }
+      leftdown = false;
+      return;
+    }
     if (button == 0) {
       if (type == 1) {
         leftdown = true;
@@ -362,6 +1078,10 @@ class UIManager {
         leftdown = false;
       }
     }
+    if (button == 1) {
+      panning_ = type == 1 && cursorpos.x > 100;
+      return;
+    }
     if (cursorpos.x <= 100) {
       if (button == 0 && type == 1) {
         if (Box(Vec2d(0, 0), Vec2d(100, 100))
@@ -422,45 +1142,26 @@ class UIManager {
     } else if (workstatus_ == SELECTION) {
       if (selected_ != nullptr) {
         if (selected_->status != Component::Status::SELECTED) {
-          selected_->ButtonEvent(&tree_, button, type);
+          selected_->ButtonEvent(index_.get(), button, type);
           return;
         }
       }
-      auto t = tree_.Retrieve(Box(cursorpos, Vec2d(0, 0)));
       bool collided = false;
-      if (t.size() != 0) {
-        vector<int> collided_index;
-        for (int i = 0; i < t.size(); ++i) {
-          Component* ti = (Component*)t[i];
-          if (ti->IsCollided(Box(cursorpos, Vec2d(0, 0)))) {
-            collided_index.push_back(i);
-          }
-        }
-        UpdateDepth();
-        if (!collided_index.empty()) {
-          int m = -1;
-          for (int i = 0; i < collided_index.size(); ++i) {
-            Component* ti = (Component*)t[i];
-            if (ti->depth_ > m) {
-              m = i;
-            }
-          }
-          Component* ti = (Component*)t[collided_index[m]];
-          if (ti->box_.IsCollided(Box(cursorpos, Vec2d(0, 0)))) {
-            ti->ButtonEvent(&tree_, button, type);
-            if (ti->status == Component::Status::SELECTED) {
-              int index = ti->depth_;
-              auto t = components[index];
-              components.erase(components.begin() + index);
-              components.push_back(t);
-              UpdateDepth();
-              if (selected_ != nullptr && selected_ != ti) {
-                selected_->Unselect();
-              }
-              selected_ = ti;
-              collided = true;
-            }
+      UpdateDepth();
+      Component* ti = HitTest(Box(worldpos_, Vec2d(0, 0)));
+      if (ti != nullptr && ti->box_.IsCollided(Box(worldpos_, Vec2d(0, 0)))) {
+        ti->ButtonEvent(index_.get(), button, type);
+        if (ti->status == Component::Status::SELECTED) {
+          int index = ti->depth_;
+          auto t = components[index];
+          components.erase(components.begin() + index);
+          components.push_back(t);
+          UpdateDepth();
+          if (selected_ != nullptr && selected_ != ti) {
+            selected_->Unselect();
           }
+          selected_ = ti;
+          collided = true;
         }
       }
       if (button == 0 && !collided && selected_ != nullptr) {
@@ -469,7 +1170,7 @@ class UIManager {
       }
     } else if (workstatus_ == ARROW) {
       if (selected_ != nullptr) {
-        selected_->ButtonEvent(&tree_, button, type);
+        selected_->ButtonEvent(index_.get(), button, type);
         Arrow* arrow = (Arrow*)selected_;
         if (arrow->astatus_ == Arrow::COMPLETED) {
           selected_ = nullptr;
@@ -480,31 +1181,31 @@ class UIManager {
       }
     } else if (workstatus_ == PROCESSBLOCK) {
       if (button == 0 && type == 1) {
-        Box box = Box(cursorpos - Vec2d(75, 50), Vec2d(150, 100));
+        Box box = Box(worldpos_ - Vec2d(75, 50), Vec2d(150, 100));
         AddComponent(make_shared<ProcessBlock>(
             ProcessBlock(&font, hb_font, &canvas, width, height, box)));
       }
     } else if (workstatus_ == STARTBLOCK) {
       if (button == 0 && type == 1) {
-        Box box = Box(cursorpos - Vec2d(75, 50), Vec2d(150, 100));
+        Box box = Box(worldpos_ - Vec2d(75, 50), Vec2d(150, 100));
         AddComponent(make_shared<StartBlock>(
             StartBlock(&font, hb_font, &canvas, width, height, box)));
       }
     } else if (workstatus_ == IOBLOCK) {
       if (button == 0 && type == 1) {
-        Box box = Box(cursorpos - Vec2d(75, 50), Vec2d(150, 100));
+        Box box = Box(worldpos_ - Vec2d(75, 50), Vec2d(150, 100));
         AddComponent(make_shared<IOBlock>(
             IOBlock(&font, hb_font, &canvas, width, height, box)));
       }
     } else if (workstatus_ == SUBBLOCK) {
       if (button == 0 && type == 1) {
-        Box box = Box(cursorpos - Vec2d(75, 50), Vec2d(150, 100));
+        Box box = Box(worldpos_ - Vec2d(75, 50), Vec2d(150, 100));
         AddComponent(make_shared<SubBlock>(
             SubBlock(&font, hb_font, &canvas, width, height, box)));
       }
     } else if (workstatus_ == CONDBLOCK) {
       if (button == 0 && type == 1) {
-        Box box = Box(cursorpos - Vec2d(75, 50), Vec2d(150, 100));
+        Box box = Box(worldpos_ - Vec2d(75, 50), Vec2d(150, 100));
         AddComponent(make_shared<CondBlock>(
             CondBlock(&font, hb_font, &canvas, width, height, box)));
       }
@@ -575,32 +1276,26 @@ class UIManager {
   void OnWindowSizeChange(double w, double h) {
     width = w;
     height = h;
-    GrGLFramebufferInfo framebufferInfo;
-    framebufferInfo.fFBOID = 0;  // assume default framebuffer
-    framebufferInfo.fFormat = GL_RGBA8;
-    GrBackendRenderTarget backendRenderTarget(w, h,
-                                              0,  // sample count
-                                              0,  // stencil bits
-                                              framebufferInfo);
-    SkColorType colorType = kRGBA_8888_SkColorType;
-    delete surface;
-    surface = SkSurface::MakeFromBackendRenderTarget(
-                  context, backendRenderTarget, kBottomLeft_GrSurfaceOrigin,
-                  colorType, nullptr, nullptr)
-                  .release();
-    if (surface == nullptr) {
-      abort();
-    }
-    canvas = surface->getCanvas();
+    UpdateView();
+    MakeSurface(w, h);
+    MakeLayer(w, h);
     UpdateDepth();
   }
 
   void DrawSidebar(double w, double h) {
-    SkBitmap bitmap;
-    bitmap.setInfo(SkImageInfo::MakeN32(100, height, kOpaque_SkAlphaType));
-    bitmap.allocPixels();
-    bitmap.eraseColor(SK_ColorWHITE);
-    SkCanvas offscr(bitmap);
+    sidebar_.Draw(canvas, context, workstatus_, kSidebarWidth, (int)h, 0, 0,
+                  [this, h](SkCanvas* c) { DrawPalette(c, h); });
+  }
+
+  // 绘制侧边栏的工具图标与分隔线
+  void DrawPalette(SkCanvas* c, double h) {
+    SkCanvas& offscr = *c;
+    offscr.clear(SK_ColorWHITE);
+    {
+      SkPaint paint;
+      paint.setColor(SK_ColorBLACK);
+      offscr.drawLine(100, 0, 100, h, paint);
+    }
 
     SkPaint paint;
     paint.setStyle(SkPaint::kStroke_Style);
@@ -705,8 +1400,6 @@ class UIManager {
         offscr.drawRect(SkRect::MakeXYWH(5, 605, 90, 90), paint);
       }
     }
-
-    canvas->writePixels(bitmap, 0, 0);
   }
 };
 
@@ -31,44 +31,13 @@ class StartBlock : public Component {
     ports_ = {Vec2d(0.5, 1), Vec2d(0.5, 0)};
   }
 
-  virtual void Render(QuadTreeNode* node, double w, double h) override {
+  virtual void Render(SpatialIndex* node, double w, double h) override {
     UpdateSize(w, h);
-
-    SkPaint paint;
-    paint.setStyle(SkPaint::kStroke_Style);
-    paint.setAntiAlias(true);
-    paint.setStrokeWidth(2);
-    if (Selected()) {
-      paint.setColor(SK_ColorBLUE);
-    } else {
-      paint.setColor(SK_ColorBLACK);
+    if (RenderGreeked()) {
+      return;
     }
 
-    double r = sqrt(0.09 * box_.size_.x * box_.size_.x +
-                    0.25 * box_.size_.y * box_.size_.y);
-    double angle =
-        atan((0.5 * box_.size_.y) / (0.3 * box_.size_.x)) * 180 / 3.14159;
-    Vec2d o1(box_.pos_.x + r, box_.pos_.y + box_.size_.y * 0.5);
-    SkRect rect1 = SkRect::MakeXYWH(o1.x - r, o1.y - r, 2 * r, 2 * r);
-    (*canvas)->drawArc(rect1, 180.0 - angle, 2 * angle, false, paint);
-
-    Vec2d o2(box_.pos_.x + box_.size_.x - r, box_.pos_.y + box_.size_.y * 0.5);
-    SkRect rect2 = SkRect::MakeXYWH(o2.x - r, o2.y - r, 2 * r, 2 * r);
-    (*canvas)->drawArc(rect2, 360 - angle, 2 * angle, false, paint);
-
-    (*canvas)->drawLine(box_.pos_.x - box_.size_.x * 0.3 + r, box_.pos_.y,
-                        box_.pos_.x + box_.size_.x - r + box_.size_.x * 0.3,
-                        box_.pos_.y, paint);
-    (*canvas)->drawLine(box_.pos_.x - box_.size_.x * 0.3 + r,
-                        box_.pos_.y + box_.size_.y,
-                        box_.pos_.x + box_.size_.x - r + box_.size_.x * 0.3,
-                        box_.pos_.y + box_.size_.y, paint);
-
-    if (Selected()) {
-      float interval[] = {10, 20};
-      paint.setPathEffect(SkDashPathEffect::Make(interval, 2, 0.0f));
-      (*canvas)->drawRect(box_.GetEdge(), paint);
-    }
+    RenderShape();
 
     double textwidth = box_.size_.x - 30;
     double textheight = box_.size_.y - 30;
@@ -77,6 +46,29 @@ class StartBlock : public Component {
                        box_.Mid(), textwidth, textheight);
   }
 
+  virtual void BuildShape(SkPath* path) override {
+    Box box(Vec2d(0, 0), box_.size_);
+    double r = sqrt(0.09 * box.size_.x * box.size_.x +
+                    0.25 * box.size_.y * box.size_.y);
+    double angle =
+        atan((0.5 * box.size_.y) / (0.3 * box.size_.x)) * 180 / 3.14159;
+    Vec2d o1(box.pos_.x + r, box.pos_.y + box.size_.y * 0.5);
+    SkRect rect1 = SkRect::MakeXYWH(o1.x - r, o1.y - r, 2 * r, 2 * r);
+    path->addArc(rect1, 180.0 - angle, 2 * angle);
+
+    Vec2d o2(box.pos_.x + box.size_.x - r, box.pos_.y + box.size_.y * 0.5);
+    SkRect rect2 = SkRect::MakeXYWH(o2.x - r, o2.y - r, 2 * r, 2 * r);
+    path->addArc(rect2, 360 - angle, 2 * angle);
+
+    path->moveTo(box.pos_.x - box.size_.x * 0.3 + r, box.pos_.y);
+    path->lineTo(box.pos_.x + box.size_.x - r + box.size_.x * 0.3, box.pos_.y);
+    path->moveTo(box.pos_.x - box.size_.x * 0.3 + r, box.pos_.y + box.size_.y);
+    path->lineTo(box.pos_.x + box.size_.x - r + box.size_.x * 0.3,
+                 box.pos_.y + box.size_.y);
+  }
+
+  virtual bool DashedFrame() override { return true; }
+
   virtual vector<Vec2d> GetLineIntersection(Vec2d p1, Vec2d p2) override {
     auto points = box_.GetVertex();
     vector<Vec2d> res;
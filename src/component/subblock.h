@@ -27,35 +27,14 @@ class SubBlock : public Component {
     ports_ = {Vec2d(0, 0.5), Vec2d(0.5, 0), Vec2d(1, 0.5), Vec2d(0.5, 1)};
   }
 
-  virtual void Render(QuadTreeNode* node, double w, double h) override {
+  virtual void Render(SpatialIndex* node, double w, double h) override {
     UpdateSize(w, h);
-
-    // RenderPorts(w, h);
-    Box box = box_;
-    SkPaint paint;
-
-    paint.setStyle(SkPaint::kStroke_Style);
-    paint.setAntiAlias(true);
-    paint.setStrokeWidth(2);
-    if (status == Status::SELECTED || status == Status::MOVING ||
-        status == Status::ZOOMING || status == Status::EDITING) {
-      paint.setColor(SK_ColorBLUE);
-      (*canvas)->drawRect(box_.GetEdge(), paint);
-      (*canvas)->drawLine(box_.pos_.x + 15, box_.pos_.y, box_.pos_.x + 15,
-                          box_.pos_.y + box_.size_.y, paint);
-      (*canvas)->drawLine(box_.pos_.x + box_.size_.x - 15, box_.pos_.y,
-                          box_.pos_.x + box_.size_.x - 15,
-                          box_.pos_.y + box_.size_.y, paint);
-    } else {
-      paint.setColor(SK_ColorBLACK);
-      (*canvas)->drawRect(box_.GetEdge(), paint);
-      (*canvas)->drawLine(box_.pos_.x + 15, box_.pos_.y, box_.pos_.x + 15,
-                          box_.pos_.y + box_.size_.y, paint);
-      (*canvas)->drawLine(box_.pos_.x + box_.size_.x - 15, box_.pos_.y,
-                          box_.pos_.x + box_.size_.x - 15,
-                          box_.pos_.y + box_.size_.y, paint);
+    if (RenderGreeked()) {
+      return;
     }
 
+    RenderShape();
+
     double textwidth = box_.size_.x - 30;
     double textheight = box_.size_.y - 30;
     Vec2d center = box_.Mid();
@@ -63,6 +42,15 @@ class SubBlock : public Component {
                        textwidth, textheight);
   }
 
+  virtual void BuildShape(SkPath* path) override {
+    Box box(Vec2d(0, 0), box_.size_);
+    path->addRect(box.GetEdge());
+    path->moveTo(box.pos_.x + 15, box.pos_.y);
+    path->lineTo(box.pos_.x + 15, box.pos_.y + box.size_.y);
+    path->moveTo(box.pos_.x + box.size_.x - 15, box.pos_.y);
+    path->lineTo(box.pos_.x + box.size_.x - 15, box.pos_.y + box.size_.y);
+  }
+
   virtual vector<Vec2d> GetLineIntersection(Vec2d p1, Vec2d p2) override {
     auto points = box_.GetVertex();
     vector<Vec2d> res;
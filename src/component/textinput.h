@@ -13,6 +13,9 @@
 
 #include <unicode/unistr.h>
 
+#include <algorithm>
+#include <cmath>
+#include <memory>
 #include <queue>
 #include <vector>
 
@@ -25,7 +28,12 @@
 #include "unicode/utext.h"
 #include "unicode/utf8.h"
 #include "unicode/utypes.h"
+#include "utils/box.h"
 #include "utils/frame.h"
+#include "utils/lod.h"
+#include "utils/shapecache.h"
+#include "utils/strokebatch.h"
+#include "utils/textatlas.h"
 #include "utils/vec2d.h"
 
 // GLFW
@@ -41,6 +49,7 @@
 #include "include/core/SkDocument.h"
 #include "include/core/SkFont.h"
 #include "include/core/SkRasterHandleAllocator.h"
+#include "include/core/SkSamplingOptions.h"
 #include "include/core/SkStream.h"
 #include "include/core/SkSurface.h"
 #include "include/core/SkTextBlob.h"
@@ -68,9 +77,26 @@ class TextInput {
   hb_font_t* hb_font = nullptr;
   hb_font_extents_t extents;
   SkFont* font;
-  SkBitmap bitmap;
-  FrameCounter fc;
+  // 排版结果，只在文字或尺寸改变时重新生成；
+  // 不可变的图像上传到显存后由Skia按图像缓存纹理，之后每帧不再上传
+  sk_sp<SkImage> image_;
+  // 设置图集后文字由图集统一绘制
+  AtlasHandle handle_;
+  // 缩小后的排版结果，中景下代替image_绘制，image_重建时丢弃
+  static constexpr double kLowResScale = 0.5;
+  sk_sp<SkImage> low_image_;
+  AtlasHandle low_handle_;
+  // 上次排版各行的宽度，远景下按此画灰条
+  vector<double> line_widths_;
+  // 细节等级，为空时总是完整排版
+  const Lod* lod_ = nullptr;
+  // 收集中时灰条交给管理器合并绘制
+  StrokeBatch* batch_ = nullptr;
   Vec2d cursor1, cursor2;
+  // 光标闪烁按时间计算，周期内前一半显示
+  static constexpr double kBlinkPeriod = 1.0;
+  double blink_start_ = 0;
+  bool cursor_shown_ = true;
   bool allow_focus = true;
   double textw = 0, texth = 0;
 
@@ -79,28 +105,104 @@ class TextInput {
 
   bool should_rerender = true;
 
+  // 可断行的位置，含0与ustr_.length()；编辑时只重算编辑处附近，
+  // 直接给ustr_赋值后须清空
+  vector<int> breaks_;
+  // 各段的排版结果，与breaks_对应，文字改变时清空；
+  // 只改变宽度时直接复用，文字改变后未改动的段从shapes_中取得
+  vector<shared_ptr<const ShapedRun>> runs_;
+  ShapeCache* shapes_ = nullptr;
+
+  // 上次绘制文本占用的区域，供重绘范围计算使用
+  Box drawn_box_;
+  bool has_drawn_ = false;
+
   TextInput(SkFont* _font, hb_font_t* _hb_font) : font(_font) {
     hb_font = _hb_font;
     hb_font_get_h_extents(hb_font, &extents);
   }
 
+  void SetShapeCache(ShapeCache* shapes) {
+    shapes_ = shapes;
+    runs_.clear();
+  }
+
+  void SetAtlas(TextAtlas* atlas) {
+    handle_.Release();
+    handle_.atlas = atlas;
+    low_handle_.Release();
+    low_handle_.atlas = atlas;
+  }
+
+  // 每个线程一个断行迭代器，避免每次排版重新载入ICU的规则数据；
+  // 使用前须setText，创建失败时返回nullptr
+  static BreakIterator* LineBreaker() {
+    thread_local unique_ptr<BreakIterator> bi = [] {
+      UErrorCode status = U_ZERO_ERROR;
+      unique_ptr<BreakIterator> res(
+          BreakIterator::createLineInstance(Locale::getChina(), status));
+      return U_SUCCESS(status) ? std::move(res) : nullptr;
+    }();
+    return bi.get();
+  }
+
   // 此函数的返回包含0与ustr_.size()
-  std::vector<int> GetPossibWrap() {
-    UErrorCode status = U_ZERO_ERROR;
-    BreakIterator* bi =
-        BreakIterator::createLineInstance(Locale::getChina(), status);
+  const std::vector<int>& GetPossibWrap() {
+    if (!breaks_.empty() && breaks_.back() == ustr_.length()) {
+      return breaks_;
+    }
+    breaks_.clear();
+    runs_.clear();
+    BreakIterator* bi = LineBreaker();
+    if (bi == nullptr) {
+      breaks_.push_back(0);
+      if (ustr_.length() > 0) {
+        breaks_.push_back(ustr_.length());
+      }
+      return breaks_;
+    }
     bi->setText(ustr_);
+    for (int32_t p = bi->first(); p != BreakIterator::DONE; p = bi->next()) {
+      breaks_.push_back(p);
+    }
+    return breaks_;
+  }
 
-    std::vector<int> boundaries;
-
-    int32_t p = bi->first();
-    while (p != BreakIterator::DONE) {
-      boundaries.push_back(p);
-      p = bi->next();
+  // ustr_在start处删去removed个、插入inserted个码元后更新断行位置。
+  // 从编辑处前两个边界开始重算，越过编辑处后一旦与原有的边界重合，
+  // 其后的边界只需平移，代价与编辑大小而非文本长度相关
+  void UpdateBreaks(int start, int removed, int inserted) {
+    runs_.clear();
+    BreakIterator* bi = LineBreaker();
+    if (breaks_.empty() || bi == nullptr) {
+      breaks_.clear();
+      return;
     }
-    delete bi;
+    int delta = inserted - removed;
+    int lo_idx = lower_bound(breaks_.begin(), breaks_.end(), start) -
+                 breaks_.begin();
+    lo_idx = max(0, lo_idx - 2);
+    auto hi = upper_bound(breaks_.begin(), breaks_.end(), start + removed);
+    vector<int> tail(hi, breaks_.end());
+    for (auto& i : tail) {
+      i += delta;
+    }
+    int lo = breaks_[lo_idx];
+    breaks_.resize(lo_idx + 1);
 
-    return boundaries;
+    bi->setText(ustr_);
+    size_t k = 0;
+    for (int32_t p = bi->following(lo); p != BreakIterator::DONE;
+         p = bi->next()) {
+      while (k < tail.size() && tail[k] < p) {
+        ++k;
+      }
+      if (p > start + inserted && k < tail.size() && tail[k] == p) {
+        breaks_.insert(breaks_.end(), tail.begin() + k, tail.end());
+        return;
+      }
+      breaks_.push_back(p);
+    }
   }
 
   void RerenderText(SkCanvas** canvas, Vec2d pos, Vec2d center, int width,
@@ -108,17 +210,36 @@ class TextInput {
     if (w != width || h != height) {
       should_rerender = true;
     }
+    // 文字不可读时不排版，待重新可读时再按最新的内容与尺寸排版
+    if (lod_ != nullptr && *lod_ != Lod::FULL) {
+      RenderLowDetail(canvas, center, width);
+      return;
+    }
     if (should_rerender) {
       w = width;
       h = height;
-      auto possiblewrap = GetPossibWrap();
+      const auto& possiblewrap = GetPossibWrap();
 
       int cursorpoint = 0;
 
       double midx = width / 2.0;
 
+      if (runs_.size() + 1 != possiblewrap.size()) {
+        static const hb_language_t language =
+            hb_language_from_string("zh-cn", -1);
+        runs_.clear();
+        for (int i = 0; i < (int)possiblewrap.size() - 1; ++i) {
+          int start = possiblewrap[i], end = possiblewrap[i + 1];
+          runs_.push_back(shapes_ != nullptr
+                              ? shapes_->Shape(hb_font, ustr_, start, end,
+                                               HB_SCRIPT_HAN, language)
+                              : ShapeCache::Make(hb_font, ustr_, start, end,
+                                                 HB_SCRIPT_HAN, language));
+        }
+      }
+
       struct UnitData {
-        hb_buffer_t* buf = nullptr;
+        const ShapedRun* run = nullptr;
         int line = 0;
         double wcnt = 0.0, width = 0.0;
       };
@@ -130,34 +251,11 @@ class TextInput {
       int glyph_cnt = 0;
 
       for (int i = 0; i < possiblewrap.size() - 1; ++i) {
-        hb_buffer_t* buf = hb_buffer_create();
-        std::string utf8;
-        UnicodeString t(ustr_, possiblewrap[i],
-                        possiblewrap[i + 1] - possiblewrap[i]);
-        t.toUTF8String(utf8);
-
-        hb_buffer_set_content_type(buf, HB_BUFFER_CONTENT_TYPE_UNICODE);
+        const ShapedRun* buf = runs_[i].get();
+        double str_width = buf->width;
 
-        // hb_buffer_add_utf8(buf, utf8.data(), -1, 0, -1);
-        for (int j = possiblewrap[i]; j < possiblewrap[i + 1]; ++j) {
-          hb_buffer_add(buf, ustr_.char32At(j), j);
-        }
-        // hb_buffer_guess_segment_properties(buf);
-        hb_buffer_set_direction(buf, HB_DIRECTION_LTR);
-        hb_buffer_set_script(buf, HB_SCRIPT_HAN);
-        hb_buffer_set_language(buf, hb_language_from_string("zh-cn", -1));
-        hb_shape(hb_font, buf, NULL, 0);
-
-        unsigned int glyph_count = hb_buffer_get_length(buf);
-        hb_glyph_info_t* glyph_info = hb_buffer_get_glyph_infos(buf, NULL);
-        hb_glyph_position_t* glyph_pos =
-            hb_buffer_get_glyph_positions(buf, NULL);
-
-        double str_width = 0.0;
-
-        for (int j = 0; j < glyph_count; ++j) {
-          str_width += glyph_pos[j].x_advance / 64.0;
-          if (focuspoint >= glyph_info[j].cluster) {
+        for (int j = 0; j < buf->glyphs.size(); ++j) {
+          if (focuspoint >= possiblewrap[i] + (int)buf->clusters[j]) {
             cursorpoint = glyph_cnt;
           }
           ++glyph_cnt;
@@ -169,7 +267,7 @@ class TextInput {
             linewidth.push_back(width_cnt - str_width);
             width_cnt = str_width;
           } else {
-            UnitData unitdata = {.buf = buf,
+            UnitData unitdata = {.run = buf,
                                  .line = line_cnt,
                                  .wcnt = width_cnt,
                                  .width = (double)str_width};
@@ -183,7 +281,7 @@ class TextInput {
         if (i == possiblewrap.size() - 2) {
           linewidth.push_back(width_cnt);
         }
-        UnitData unitdata = {.buf = buf,
+        UnitData unitdata = {.run = buf,
                              .line = line_cnt,
                              .wcnt = width_cnt,
                              .width = (double)str_width};
@@ -205,31 +303,32 @@ class TextInput {
         total_width =
             max(0.0, *max_element(linewidth.begin(), linewidth.end()));
       }
+      line_widths_ = linewidth;
+      SkBitmap bitmap;
       bitmap.setInfo(
-          SkImageInfo::MakeN32(total_width, total_height, kOpaque_SkAlphaType));
+          SkImageInfo::MakeN32Premul(total_width, total_height));
       textw = total_width;
       texth = total_height;
       bitmap.allocPixels();
+      // 白底遮住下层组件，与按深度绘制的遮挡关系一致
       bitmap.eraseColor(SK_ColorWHITE);
       SkCanvas offscr(bitmap);
       glyph_cnt = 0;
       while (!buffers.empty()) {
-        hb_buffer_t* buf = buffers.front().buf;
-        hb_glyph_info_t* glyph_info = hb_buffer_get_glyph_infos(buf, NULL);
-        hb_glyph_position_t* glyph_pos =
-            hb_buffer_get_glyph_positions(buf, NULL);
+        const ShapedRun* buf = buffers.front().run;
+        const hb_glyph_position_t* glyph_pos = buf->positions.data();
 
         double current_y = SPACING_RATIO * FONT_SIZE * buffers.front().line;
         double str_width = buffers.front().width;
         double wcnt = buffers.front().wcnt;
-        unsigned len = hb_buffer_get_length(buf);
+        unsigned len = buf->glyphs.size();
         double x = 0.0, y = extents.ascender / 64.0;
         SkTextBlobBuilder builder;
         auto runBuffer = builder.allocRunPos(*font, len);
         SkPaint paint;
         paint.setColor(SK_ColorBLACK);
         for (int i = 0; i < len; ++i) {
-          runBuffer.glyphs[i] = glyph_info[i].codepoint;
+          runBuffer.glyphs[i] = buf->glyphs[i];
           reinterpret_cast<SkPoint*>(runBuffer.pos)[i] =
               SkPoint::Make(x + glyph_pos[i].x_offset / 64.0,
                             y - glyph_pos[i].y_offset / 64.0);
@@ -248,14 +347,25 @@ class TextInput {
         }
 
         offscr.drawTextBlob(builder.make(), wcnt - str_width, current_y, paint);
-        hb_buffer_destroy(buf);
         buffers.pop();
       }
+      bitmap.setImmutable();
+      image_ = bitmap.asImage();
+      handle_.Release();
+      low_image_ = nullptr;
+      low_handle_.Release();
       should_rerender = false;
     }
-    (*canvas)->writePixels(bitmap, center.x - textw / 2.0,
-                           center.y - texth / 2.0);
-    if (fc.frame % 60 < 30 && status_ == EDIT && cursor1.x >= 0 &&
+    // writePixels不受裁剪区域影响，局部重绘时会覆盖其他组件，故用drawImage。
+    // 图集在组件绘制后才画出，会盖住光标，编辑中的文字直接画
+    double left = center.x - textw / 2.0, top = center.y - texth / 2.0;
+    if (image_ != nullptr &&
+        (status_ == EDIT || !handle_.Draw(image_, left, top))) {
+      (*canvas)->drawImage(image_, left, top);
+    }
+    drawn_box_ = Box(Vec2d(left, top), Vec2d(textw, texth));
+    has_drawn_ = true;
+    if (cursor_shown_ && status_ == EDIT && cursor1.x >= 0 &&
         cursor2.x <= width && cursor1.y >= 0 && cursor2.y <= height) {
       SkPaint paint;
       paint.setAntiAlias(true);
@@ -266,7 +376,104 @@ class TextInput {
                           cursor2.x + center.x - textw / 2.0,
                           cursor2.y + center.y - texth / 2.0, paint);
     }
-    fc.RenderFrame();
+  }
+
+  const sk_sp<SkImage>& LowResImage() {
+    if (low_image_ == nullptr && image_ != nullptr) {
+      int lw = max(1, (int)ceil(image_->width() * kLowResScale));
+      int lh = max(1, (int)ceil(image_->height() * kLowResScale));
+      sk_sp<SkSurface> surface =
+          SkSurface::MakeRaster(SkImageInfo::MakeN32Premul(lw, lh));
+      if (surface != nullptr) {
+        surface->getCanvas()->clear(SK_ColorWHITE);
+        surface->getCanvas()->drawImageRect(
+            image_, SkRect::MakeWH(lw, lh),
+            SkSamplingOptions(SkFilterMode::kLinear, SkMipmapMode::kLinear));
+        low_image_ = surface->makeImageSnapshot();
+      }
+    }
+    return low_image_;
+  }
+
+  // 中景下绘制缩小的图像，从未排版过时以灰条代替，均不显示光标
+  void RenderLowDetail(SkCanvas** canvas, Vec2d center, int width) {
+    if (image_ == nullptr) {
+      SkPath bars;
+      AddGreekBars(center, width, &bars);
+      if (batch_ == nullptr || !batch_->Add(StrokeBatch::GREEK, bars, 0, 0)) {
+        (*canvas)->drawPath(bars, StrokeBatch::MakePaint(StrokeBatch::GREEK));
+      }
+      return;
+    }
+    double left = center.x - textw / 2.0, top = center.y - texth / 2.0;
+    const sk_sp<SkImage>& low = LowResImage();
+    if (low != nullptr &&
+        !low_handle_.Draw(low, left, top, 1 / kLowResScale)) {
+      (*canvas)->drawImageRect(low, SkRect::MakeXYWH(left, top, textw, texth),
+                               SkSamplingOptions(SkFilterMode::kLinear));
+    }
+    drawn_box_ = Box(Vec2d(left, top), Vec2d(textw, texth));
+    has_drawn_ = true;
+  }
+
+  // 每行文字画成一条灰条，以center为中心；尚未排版时按每字一个字宽估计
+  void AddGreekBars(Vec2d center, double width, SkPath* path) {
+    double line_h = FONT_SIZE * SPACING_RATIO;
+    auto add_lines = [&](int count, auto line_width) {
+      double maxw = 0;
+      for (int i = 0; i < count; ++i) {
+        maxw = max(maxw, line_width(i));
+      }
+      double left = center.x - maxw / 2.0;
+      double top = center.y - count * line_h / 2.0;
+      for (int i = 0; i < count; ++i) {
+        path->addRect(SkRect::MakeXYWH(left, top + i * line_h + FONT_SIZE / 4.0,
+                                       line_width(i), FONT_SIZE / 2.0));
+      }
+    };
+    if (image_ != nullptr) {
+      add_lines(line_widths_.size(), [this](int i) { return line_widths_[i]; });
+      return;
+    }
+    double total = ustr_.length() * FONT_SIZE;
+    if (total <= 0 || width <= 0) {
+      return;
+    }
+    int count = ceil(total / width);
+    add_lines(count, [&](int i) { return min(width, total - i * width); });
+  }
+
+  bool CursorVisible(double now) {
+    return fmod(now - blink_start_, kBlinkPeriod) < kBlinkPeriod / 2;
+  }
+
+  // 编辑状态下光标到了该切换明暗的时候
+  bool BlinkDue(double now) {
+    return status_ == EDIT && CursorVisible(now) != cursor_shown_;
+  }
+
+  // 更新光标明暗，编辑状态下有变化时返回true
+  bool Tick(double now) {
+    bool due = BlinkDue(now);
+    cursor_shown_ = CursorVisible(now);
+    return due;
+  }
+
+  // 下一次光标切换明暗的时间
+  double NextBlink(double now) {
+    double half = kBlinkPeriod / 2;
+    return blink_start_ + (floor((now - blink_start_) / half) + 1) * half;
+  }
+
+  // 移动光标后重新开始闪烁，使光标立即可见
+  void ResetBlink() {
+    blink_start_ = Now();
+    cursor_shown_ = true;
+  }
+
+  // 将上次绘制的文本区域并入box
+  Box JoinBound(const Box& box) {
+    return has_drawn_ ? box.Join(drawn_box_) : box;
   }
 
   enum TextStatus { SHOW, EDIT };
@@ -281,7 +488,9 @@ class TextInput {
       return;
     }
     if (status_ == EDIT) {
+      int len = ustr_.length();
       ustr_.insert(focuspoint, (UChar32)codepoint);
+      UpdateBreaks(focuspoint, 0, ustr_.length() - len);
       ++focuspoint;
       should_rerender = true;
     }
@@ -295,6 +504,7 @@ class TextInput {
         (action == GLFW_PRESS || action == GLFW_REPEAT)) {
       if (focuspoint >= 1) {
         ustr_.remove(focuspoint - 1, 1);
+        UpdateBreaks(focuspoint - 1, 1, 0);
         --focuspoint;
         should_rerender = true;
       }
@@ -304,6 +514,7 @@ class TextInput {
       const char* clip = glfwGetClipboardString(window);
       UnicodeString clip_u = UnicodeString::fromUTF8(clip);
       ustr_.insert(focuspoint, clip_u);
+      UpdateBreaks(focuspoint, 0, clip_u.length());
       focuspoint += clip_u.length();
       should_rerender = true;
     }
@@ -313,7 +524,7 @@ class TextInput {
       if (focuspoint < 0) {
         focuspoint = 0;
       }
-      fc.frame = 0;
+      ResetBlink();
       should_rerender = true;
     }
     if (key == GLFW_KEY_RIGHT &&
@@ -322,7 +533,7 @@ class TextInput {
       if (focuspoint > ustr_.length()) {
         focuspoint = ustr_.length();
       }
-      fc.frame = 0;
+      ResetBlink();
       should_rerender = true;
     }
   }
@@ -11,14 +11,19 @@
 
 #include <glad/glad.h>
 
+#include <algorithm>
+#include <cstdlib>
 #include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
 
 #include "GLFW/glfw3.h"
 #include "component/arrow.h"
 #include "component/manager.h"
 #include "component/process.h"
 // #include "component/textinput.h"
-#include "utils/quadtree.h"
+#include "utils/spatialindex.h"
 #include "utils/vec2d.h"
 
 #define SK_GANESH
@@ -36,6 +41,9 @@ UIManager mng(1200, 800);
 
 int width, height;
 
+// 上次绘制后收到过输入，光标预览图形等需要重画
+bool input_pending = true;
+
 void framebuffer_size_callback(GLFWwindow* window, int w, int h) {
   // glViewport(0, 0, w, h);
   width = w;
@@ -45,22 +53,87 @@ void framebuffer_size_callback(GLFWwindow* window, int w, int h) {
 }
 
 void mouse_callback(GLFWwindow* window, double xpos, double ypos) {
+  input_pending = true;
   mng.OnCursorEvent(xpos, ypos);
 }
 
 void key_callback(GLFWwindow* window, int key, int scancode, int action,
                   int mode) {
+  input_pending = true;
   mng.OnKeyboardEvent(window, key, action, mode);
 }
 
 void mousebutton_callback(GLFWwindow* window, int button, int action,
                           int other) {
+  input_pending = true;
   mng.OnButtonEvent(button, action);
 }
 
-void char_callback(GLFWwindow* window, unsigned ch) { mng.OnCharEvent(ch); }
+void char_callback(GLFWwindow* window, unsigned ch) {
+  input_pending = true;
+  mng.OnCharEvent(ch);
+}
+
+void scroll_callback(GLFWwindow* window, double xoffset, double yoffset) {
+  input_pending = true;
+  mng.OnScrollEvent(xoffset, yoffset);
+}
+
+// 窗口被遮挡后重新露出时后台缓冲区内容已失效，需再画一帧
+void refresh_callback(GLFWwindow* window) { input_pending = true; }
+
+// 由--index=quadtree|grid|bvh选择空间索引，默认为四叉树，
+// --index-autotune开启四叉树的自动调整
+SpatialIndex::Type ParseIndexType(int argc, char** argv) {
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--index=grid") {
+      return SpatialIndex::Type::GRID;
+    }
+    if (arg == "--index=bvh") {
+      return SpatialIndex::Type::BVH;
+    }
+  }
+  return SpatialIndex::Type::QUADTREE;
+}
 
 int main(int argc, char** argv) {
+  mng.SetIndexType(ParseIndexType(argc, argv));
+  for (int i = 1; i < argc; ++i) {
+    if (std::string(argv[i]) == "--index-autotune") {
+      mng.SetAutoTune(true);
+    }
+  }
+
+  // --export=<file>在内存中绘制一帧并保存为PNG，不创建窗口。
+  // 目前没有可载入的文档格式，命令行只能导出--grid=<n>生成的n×n个方框，
+  // 供测试性能与生成示例图；嵌入时由ExportDocument的build参数建立文档
+  std::string export_path;
+  int grid = 0;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg.rfind("--export=", 0) == 0) {
+      export_path = arg.substr(9);
+    } else if (arg.rfind("--grid=", 0) == 0) {
+      grid = std::max(0, std::atoi(arg.substr(7).c_str()));
+    }
+  }
+  if (!export_path.empty()) {
+    bool ok = mng.ExportDocument(
+        export_path.c_str(), 1200, 800, [grid](UIManager& m) {
+          std::vector<std::shared_ptr<Component>> cs;
+          for (int i = 0; i < grid; ++i) {
+            for (int j = 0; j < grid; ++j) {
+              Box box(Vec2d(j * 200, i * 150), Vec2d(150, 100));
+              cs.push_back(std::make_shared<ProcessBlock>(ProcessBlock(
+                  &m.font, m.hb_font, &m.canvas, m.width, m.height, box)));
+            }
+          }
+          m.AddComponents(cs);
+        });
+    return ok ? 0 : 1;
+  }
+
   glfwInit();
   glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
   glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 6);
@@ -75,6 +148,8 @@ int main(int argc, char** argv) {
   }
 
   glfwMakeContextCurrent(window);
+  // 由垂直同步限制帧率
+  glfwSwapInterval(1);
   glfwGetFramebufferSize(window, &width, &height);
 
   glfwSetCursorPosCallback(window, mouse_callback);
@@ -82,14 +157,26 @@ int main(int argc, char** argv) {
   glfwSetKeyCallback(window, key_callback);
   glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
   glfwSetCharCallback(window, char_callback);
+  glfwSetScrollCallback(window, scroll_callback);
+  glfwSetWindowRefreshCallback(window, refresh_callback);
 
   mng.InitSkia(1200, 800);
 
+  // 没有输入、没有待重绘的内容且光标不需闪烁时阻塞等待，不占用CPU与GPU
   while (!glfwWindowShouldClose(window)) {
-    _sleep(10);
-
-    glfwPollEvents();
-
+    double timeout = mng.FrameTimeout(Now());
+    if (input_pending || timeout == 0) {
+      glfwPollEvents();
+    } else if (timeout > 0) {
+      glfwWaitEventsTimeout(timeout);
+    } else {
+      glfwWaitEvents();
+    }
+
+    if (!input_pending && mng.FrameTimeout(Now()) != 0) {
+      continue;
+    }
+    input_pending = false;
     mng.ProcessFrame(width, height);
 
     glfwSwapBuffers(window);
@@ -0,0 +1,433 @@
+/**
+ * @file aabbtree.h
+ * @author MCMocoder (mcmocoder@ametav.com)
+ * @brief
+ * @version 0.1
+ * @date 2023-06-12
+ *
+ * @copyright Copyright (c) 2023 Mocoder Studio
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "utils/spatialindex.h"
+
+namespace mocoder {
+
+using namespace std;
+
+// 动态AABB树（BVH）：叶子保存对象外扩kMargin后的包围盒，
+// 插入时按周长代价选择兄弟节点，并以AVL式旋转保持平衡。
+// 包围盒可以重叠，不依赖画布范围，适合长箭头等大小悬殊、分布稀疏的组件。
+// 对象的node_为叶子节点下标
+class AabbTree : public SpatialIndex {
+ public:
+  static constexpr uint32_t kNull = UINT32_MAX;
+  // 对象在外扩的包围盒内移动时不必重新插入
+  static constexpr double kMargin = 8;
+
+  struct Node {
+    Box box_;
+    uint32_t parent_ = kNull;  // 空闲节点以parent_串联
+    uint32_t left_ = kNull;
+    uint32_t right_ = kNull;
+    BoxedObj* obj_ = nullptr;
+    int height_ = 0;  // 叶子为0
+    bool IsLeaf() const { return left_ == kNull; }
+  };
+
+  struct NearestEntry {
+    double dist;
+    uint32_t index;
+    bool is_obj;
+  };
+
+  vector<Node> nodes_;
+  uint32_t root_ = kNull;
+  uint32_t free_ = kNull;
+  int obj_cnt_ = 0;
+  vector<uint32_t> stack_;
+  vector<NearestEntry> nn_heap_;
+
+  AabbTree() { Clear(); }
+
+  ~AabbTree() {
+    for (auto& node : nodes_) {
+      if (node.obj_ != nullptr && Contains(node.obj_)) {
+        node.obj_->index_ = nullptr;
+      }
+    }
+  }
+
+  void Clear() override {
+    ++epoch_;
+    nodes_.clear();
+    root_ = kNull;
+    free_ = kNull;
+    obj_cnt_ = 0;
+  }
+
+  void Insert(BoxedObj* obj) override {
+    if (Contains(obj)) {
+      return;
+    }
+    uint32_t leaf = AllocLeaf(obj);
+    InsertLeaf(leaf);
+  }
+
+  void Remove(BoxedObj* obj) override {
+    if (!Contains(obj)) {
+      return;
+    }
+    uint32_t leaf = obj->node_;
+    RemoveLeaf(leaf);
+    FreeNode(leaf);
+    obj->index_ = nullptr;
+    --obj_cnt_;
+  }
+
+  // 对象仍在叶子的外扩包围盒内时不做任何事
+  void Update(BoxedObj* obj) override {
+    if (!Contains(obj)) {
+      return;
+    }
+    uint32_t leaf = obj->node_;
+    if (InBound(nodes_[leaf].box_, obj->box_)) {
+      return;
+    }
+    RemoveLeaf(leaf);
+    nodes_[leaf].box_ = Fatten(obj->box_);
+    InsertLeaf(leaf);
+  }
+
+  // 自顶向下按包围盒中心在较长轴上的中位数二分，建成平衡的树
+  void Build(const vector<BoxedObj*>& objs) override {
+    Clear();
+    if (objs.empty()) {
+      return;
+    }
+    nodes_.reserve(objs.size() * 2);
+    vector<uint32_t> leaves;
+    leaves.reserve(objs.size());
+    for (auto i : objs) {
+      if (!Contains(i)) {
+        leaves.push_back(AllocLeaf(i));
+      }
+    }
+    root_ = Build(leaves.data(), 0, leaves.size());
+    nodes_[root_].parent_ = kNull;
+  }
+
+  int Count() override { return obj_cnt_; }
+
+  bool QueryOverlap(const Box& box, Visitor visit) override {
+    ++stats_.queries;
+    if (root_ == kNull) {
+      return true;
+    }
+    // 栈以base为底，visitor中嵌套查询也不会破坏本次遍历
+    size_t base = stack_.size();
+    stack_.push_back(root_);
+    while (stack_.size() > base) {
+      uint32_t n = stack_.back();
+      stack_.pop_back();
+      ++stats_.nodes;
+      if (!nodes_[n].box_.Overlaps(box)) {
+        continue;
+      }
+      if (!nodes_[n].IsLeaf()) {
+        stack_.push_back(nodes_[n].left_);
+        stack_.push_back(nodes_[n].right_);
+        continue;
+      }
+      BoxedObj* obj = nodes_[n].obj_;
+      ++stats_.candidates;
+      if (!obj->box_.Overlaps(box)) {
+        continue;
+      }
+      ++stats_.hits;
+      if (!visit(obj)) {
+        stack_.resize(base);
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool QuerySegment(Vec2d p1, Vec2d p2, Visitor visit) override {
+    ++stats_.queries;
+    if (root_ == kNull) {
+      return true;
+    }
+    size_t base = stack_.size();
+    stack_.push_back(root_);
+    while (stack_.size() > base) {
+      uint32_t n = stack_.back();
+      stack_.pop_back();
+      ++stats_.nodes;
+      if (!SegmentHitsBox(p1, p2, nodes_[n].box_)) {
+        continue;
+      }
+      if (!nodes_[n].IsLeaf()) {
+        stack_.push_back(nodes_[n].left_);
+        stack_.push_back(nodes_[n].right_);
+        continue;
+      }
+      BoxedObj* obj = nodes_[n].obj_;
+      ++stats_.candidates;
+      if (!SegmentHitsBox(p1, p2, obj->box_)) {
+        continue;
+      }
+      ++stats_.hits;
+      if (!visit(obj)) {
+        stack_.resize(base);
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // 节点按外扩包围盒的距离、对象按自身包围盒的距离放在同一个最小堆中
+  bool QueryNearest(Vec2d p, double radius, NearestVisitor visit) override {
+    ++stats_.queries;
+    if (root_ == kNull) {
+      return true;
+    }
+    auto& heap = nn_heap_;
+    auto cmp = [](const NearestEntry& a, const NearestEntry& b) {
+      return a.dist > b.dist;
+    };
+    auto push = [&](double d, uint32_t index, bool is_obj) {
+      if (d <= radius) {
+        heap.push_back({d, index, is_obj});
+        push_heap(heap.begin(), heap.end(), cmp);
+      }
+    };
+    heap.clear();
+    push(Distance(p, nodes_[root_].box_), root_, false);
+    while (!heap.empty()) {
+      pop_heap(heap.begin(), heap.end(), cmp);
+      NearestEntry e = heap.back();
+      heap.pop_back();
+      const Node& node = nodes_[e.index];
+      if (e.is_obj) {
+        ++stats_.hits;
+        if (!visit(node.obj_, e.dist)) {
+          return false;
+        }
+        continue;
+      }
+      ++stats_.nodes;
+      if (node.IsLeaf()) {
+        ++stats_.candidates;
+        push(Distance(p, node.obj_->box_), e.index, true);
+        continue;
+      }
+      push(Distance(p, nodes_[node.left_].box_), node.left_, false);
+      push(Distance(p, nodes_[node.right_].box_), node.right_, false);
+    }
+    return true;
+  }
+
+  int Height() { return root_ == kNull ? 0 : nodes_[root_].height_; }
+
+ private:
+  static Box Fatten(const Box& box) {
+    return Box(Vec2d(box.pos_.x - kMargin, box.pos_.y - kMargin),
+               Vec2d(box.size_.x + kMargin * 2, box.size_.y + kMargin * 2));
+  }
+
+  static double Perimeter(const Box& box) {
+    return 2 * (box.size_.x + box.size_.y);
+  }
+
+  uint32_t AllocNode() {
+    uint32_t n;
+    if (free_ != kNull) {
+      n = free_;
+      free_ = nodes_[n].parent_;
+    } else {
+      n = nodes_.size();
+      nodes_.emplace_back();
+    }
+    nodes_[n] = Node();
+    return n;
+  }
+
+  void FreeNode(uint32_t n) {
+    nodes_[n] = Node();
+    nodes_[n].parent_ = free_;
+    free_ = n;
+  }
+
+  uint32_t AllocLeaf(BoxedObj* obj) {
+    uint32_t leaf = AllocNode();
+    nodes_[leaf].box_ = Fatten(obj->box_);
+    nodes_[leaf].obj_ = obj;
+    Attach(obj);
+    obj->node_ = leaf;
+    ++obj_cnt_;
+    return leaf;
+  }
+
+  uint32_t Build(uint32_t* leaves, size_t begin, size_t end) {
+    if (end - begin == 1) {
+      return leaves[begin];
+    }
+    double minx = numeric_limits<double>::infinity(), maxx = -minx;
+    double miny = minx, maxy = -minx;
+    auto center = [this](uint32_t n, int axis) {
+      const Box& box = nodes_[n].box_;
+      return axis == 0 ? box.pos_.x + box.size_.x / 2
+                       : box.pos_.y + box.size_.y / 2;
+    };
+    for (size_t i = begin; i < end; ++i) {
+      double cx = center(leaves[i], 0), cy = center(leaves[i], 1);
+      minx = min(minx, cx);
+      maxx = max(maxx, cx);
+      miny = min(miny, cy);
+      maxy = max(maxy, cy);
+    }
+    int axis = maxx - minx >= maxy - miny ? 0 : 1;
+    size_t mid = begin + (end - begin) / 2;
+    nth_element(leaves + begin, leaves + mid, leaves + end,
+                [&](uint32_t a, uint32_t b) {
+                  return center(a, axis) < center(b, axis);
+                });
+    uint32_t left = Build(leaves, begin, mid);
+    uint32_t right = Build(leaves, mid, end);
+    uint32_t n = AllocNode();
+    Link(n, left, right);
+    return n;
+  }
+
+  // 由两个子节点重算n的包围盒与高度
+  void Link(uint32_t n, uint32_t left, uint32_t right) {
+    Node& node = nodes_[n];
+    node.left_ = left;
+    node.right_ = right;
+    nodes_[left].parent_ = n;
+    nodes_[right].parent_ = n;
+    Refit(n);
+  }
+
+  void Refit(uint32_t n) {
+    Node& node = nodes_[n];
+    const Node& left = nodes_[node.left_];
+    const Node& right = nodes_[node.right_];
+    node.box_ = Union(left.box_, right.box_);
+    node.height_ = 1 + max(left.height_, right.height_);
+  }
+
+  void ReplaceChild(uint32_t parent, uint32_t old_child, uint32_t new_child) {
+    if (parent == kNull) {
+      root_ = new_child;
+    } else if (nodes_[parent].left_ == old_child) {
+      nodes_[parent].left_ = new_child;
+    } else {
+      nodes_[parent].right_ = new_child;
+    }
+    nodes_[new_child].parent_ = parent;
+  }
+
+  // 从叶子的父节点开始向上旋转并重算包围盒
+  void FixUpward(uint32_t n) {
+    while (n != kNull) {
+      n = Balance(n);
+      Refit(n);
+      n = nodes_[n].parent_;
+    }
+  }
+
+  void InsertLeaf(uint32_t leaf) {
+    if (root_ == kNull) {
+      root_ = leaf;
+      nodes_[leaf].parent_ = kNull;
+      return;
+    }
+    // 沿代价最小的方向下降：新建父节点的周长，加上路径上祖先包围盒增大的周长
+    Box box = nodes_[leaf].box_;
+    uint32_t n = root_;
+    while (!nodes_[n].IsLeaf()) {
+      const Node& node = nodes_[n];
+      double combined = Perimeter(Union(node.box_, box));
+      double cost = 2 * combined;
+      double inherit = 2 * (combined - Perimeter(node.box_));
+      auto child_cost = [&](uint32_t c) {
+        const Node& child = nodes_[c];
+        double grow = Perimeter(Union(child.box_, box));
+        if (!child.IsLeaf()) {
+          grow -= Perimeter(child.box_);
+        }
+        return grow + inherit;
+      };
+      double cost1 = child_cost(node.left_);
+      double cost2 = child_cost(node.right_);
+      if (cost < cost1 && cost < cost2) {
+        break;
+      }
+      n = cost1 < cost2 ? node.left_ : node.right_;
+    }
+
+    uint32_t parent = nodes_[n].parent_;
+    uint32_t p = AllocNode();
+    ReplaceChild(parent, n, p);
+    Link(p, n, leaf);
+    FixUpward(p);
+  }
+
+  void RemoveLeaf(uint32_t leaf) {
+    if (leaf == root_) {
+      root_ = kNull;
+      return;
+    }
+    uint32_t parent = nodes_[leaf].parent_;
+    uint32_t grand = nodes_[parent].parent_;
+    uint32_t sibling = nodes_[parent].left_ == leaf ? nodes_[parent].right_
+                                                    : nodes_[parent].left_;
+    ReplaceChild(grand, parent, sibling);
+    FreeNode(parent);
+    nodes_[leaf].parent_ = kNull;
+    FixUpward(grand);
+  }
+
+  // 子树高度差超过1时，把较高的子节点旋转上来，返回旋转后子树的根
+  uint32_t Balance(uint32_t a) {
+    if (nodes_[a].IsLeaf() || nodes_[a].height_ < 2) {
+      return a;
+    }
+    uint32_t b = nodes_[a].left_, c = nodes_[a].right_;
+    int balance = nodes_[c].height_ - nodes_[b].height_;
+    if (balance > 1) {
+      return Rotate(a, c, false);
+    }
+    if (balance < -1) {
+      return Rotate(a, b, true);
+    }
+    return a;
+  }
+
+  // 将a的子节点up提升为a的父节点，up较高的子节点留在up下，较矮的交给a
+  uint32_t Rotate(uint32_t a, uint32_t up, bool up_is_left) {
+    uint32_t f = nodes_[up].left_, g = nodes_[up].right_;
+    uint32_t tall = nodes_[f].height_ > nodes_[g].height_ ? f : g;
+    uint32_t other = tall == f ? g : f;
+    ReplaceChild(nodes_[a].parent_, a, up);
+    if (up_is_left) {
+      Link(a, other, nodes_[a].right_);
+    } else {
+      Link(a, nodes_[a].left_, other);
+    }
+    Link(up, a, tall);
+    return up;
+  }
+};
+
+}  // namespace mocoder
@@ -11,6 +11,7 @@
 
 #pragma once
 
+#include <algorithm>
 #include <vector>
 
 #include "include/core/SkRect.h"
@@ -32,6 +33,32 @@ class Box {
     return (pos_.x < b.pos_.x + b.size_.x) && (pos_.x + size_.x > b.pos_.x) &&
            (pos_.y < b.pos_.y + b.size_.y) && (pos_.y + size_.y > b.pos_.y);
   }
+  // 闭区间相交测试，边界接触也算相交
+  bool Overlaps(const Box& b) const {
+    return (pos_.x <= b.pos_.x + b.size_.x) && (b.pos_.x <= pos_.x + size_.x) &&
+           (pos_.y <= b.pos_.y + b.size_.y) && (b.pos_.y <= pos_.y + size_.y);
+  }
+  // 同时包含两个盒子的最小盒子
+  Box Join(const Box& b) const {
+    double minx = min(pos_.x, b.pos_.x);
+    double miny = min(pos_.y, b.pos_.y);
+    double maxx = max(pos_.x + size_.x, b.pos_.x + b.size_.x);
+    double maxy = max(pos_.y + size_.y, b.pos_.y + b.size_.y);
+    return Box(Vec2d(minx, miny), Vec2d(maxx - minx, maxy - miny));
+  }
+  // 两个盒子的交集，不相交时尺寸为0
+  Box Intersect(const Box& b) const {
+    double minx = max(pos_.x, b.pos_.x);
+    double miny = max(pos_.y, b.pos_.y);
+    double maxx = min(pos_.x + size_.x, b.pos_.x + b.size_.x);
+    double maxy = min(pos_.y + size_.y, b.pos_.y + b.size_.y);
+    return Box(Vec2d(minx, miny), Vec2d(max(0.0, maxx - minx), max(0.0, maxy - miny)));
+  }
+  // 四周各向外扩展d
+  Box Outset(double d) const {
+    return Box(Vec2d(pos_.x - d, pos_.y - d),
+               Vec2d(size_.x + 2 * d, size_.y + 2 * d));
+  }
   vector<Vec2d> GetVertex() {
     return {Vec2d(pos_.x, pos_.y), Vec2d(pos_.x, pos_.y + size_.y),
             Vec2d(pos_.x + size_.x, pos_.y + size_.y),
@@ -39,7 +66,7 @@ class Box {
   }
   bool operator==(Box& b) { return pos_ == b.pos_ && size_ == b.size_; }
   Vec2d Mid() { return pos_ + size_ / 2; }
-  SkRect GetEdge() {
+  SkRect GetEdge() const {
     return SkRect({(float)pos_.x, (float)pos_.y, (float)pos_.x + (float)size_.x,
                    (float)pos_.y + (float)size_.y});
   }
@@ -11,34 +11,53 @@
 
 #pragma once
 
+#include <cstdint>
+
 #include "utils/box.h"
 
 namespace mocoder {
 
+class SpatialIndex;
+
 class BoxedObj {
  public:
   Box box_;
   Box inbox_;
+  // 所在的空间索引，不在索引中时index_为nullptr，
+  // node_、item_由具体的索引实现解释
+  SpatialIndex* index_ = nullptr;
+  uint32_t node_ = 0;
+  uint32_t item_ = 0;
+  uint32_t epoch_ = 0;
   BoxedObj(const Box& box) { SetBox(box); }
-  virtual ~BoxedObj() {}
+  BoxedObj(const BoxedObj& obj) : box_(obj.box_), inbox_(obj.inbox_) {}
+  virtual ~BoxedObj() { DetachNode(); }
+  // 世界坐标不设下限，可见范围由调用者按视图判断
   void SetBox(Box box) {
-    if (box.pos_.x < 0) {
-      box.pos_.x = 0;
-    }
-    if (box.pos_.y < 0) {
-      box.pos_.y = 0;
-    }
     if (box.size_.x < 0) {
       box.size_.x = 0;
     }
     if (box.size_.y < 0) {
       box.size_.y = 0;
     }
+    bool moved = !(box == box_);
+    Box old = box_;
     box_ = box;
     inbox_ = box_;
     inbox_.size_ = inbox_.size_ - Vec2d(30, 30);
     inbox_.pos_ = inbox_.pos_ + Vec2d(15, 15);
+    if (moved) {
+      UpdateNode();
+      OnMoved(old);
+    }
   }
+
+  // 包围盒改变后调用，old为改变前的包围盒
+  virtual void OnMoved(const Box& old) {}
+
+  // 以下两个函数定义于spatialindex.h
+  inline void UpdateNode();
+  inline void DetachNode();
 };
 
 }  // namespace mocoder
@@ -0,0 +1,76 @@
+/**
+ * @file cachedlayer.h
+ * @author MCMocoder (mcmocoder@ametav.com)
+ * @brief
+ * @version 0.1
+ * @date 2023-06-15
+ *
+ * @copyright Copyright (c) 2023 Mocoder Studio
+ *
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#define SK_GANESH
+#define SK_GL
+#include "include/core/SkCanvas.h"
+#include "include/core/SkImage.h"
+#include "include/core/SkSurface.h"
+#include "include/gpu/GrDirectContext.h"
+
+namespace mocoder {
+
+using namespace std;
+
+// 缓存很少变化的界面元素，内容只由key与尺寸决定，
+// 二者不变时直接绘制上次生成的图像，不再逐帧光栅化与上传
+class CachedLayer {
+ public:
+  sk_sp<SkImage> image_;
+  uint64_t key_ = 0;
+  int w_ = 0, h_ = 0;
+
+  // key或尺寸改变时调用draw在新图像上重新绘制，draw接受SkCanvas*
+  // context不为空时图像留在显存中，否则退化为内存中的图像
+  template <class F>
+  const sk_sp<SkImage>& Get(GrDirectContext* context, uint64_t key, int w,
+                            int h, F&& draw) {
+    if (image_ != nullptr && key == key_ && w == w_ && h == h_) {
+      return image_;
+    }
+    image_ = nullptr;
+    if (w <= 0 || h <= 0) {
+      return image_;
+    }
+    SkImageInfo info = SkImageInfo::MakeN32Premul(w, h);
+    sk_sp<SkSurface> surface =
+        context != nullptr
+            ? SkSurface::MakeRenderTarget(context, SkBudgeted::kNo, info)
+            : SkSurface::MakeRaster(info);
+    if (surface == nullptr) {
+      return image_;
+    }
+    draw(surface->getCanvas());
+    image_ = surface->makeImageSnapshot();
+    key_ = key;
+    w_ = w;
+    h_ = h;
+    return image_;
+  }
+
+  template <class F>
+  void Draw(SkCanvas* canvas, GrDirectContext* context, uint64_t key, int w,
+            int h, double x, double y, F&& draw) {
+    auto& image = Get(context, key, w, h, draw);
+    if (image != nullptr) {
+      canvas->drawImage(image, x, y);
+    }
+  }
+
+  // 丢弃缓存，下次使用时重新绘制
+  void Reset() { image_ = nullptr; }
+};
+
+}  // namespace mocoder
@@ -0,0 +1,72 @@
+/**
+ * @file camera.h
+ * @author MCMocoder (mcmocoder@ametav.com)
+ * @brief
+ * @version 0.1
+ * @date 2023-06-20
+ *
+ * @copyright Copyright (c) 2023 Mocoder Studio
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+
+#include "utils/box.h"
+#include "utils/vec2d.h"
+
+#define SK_GANESH
+#define SK_GL
+#include "include/core/SkCanvas.h"
+
+namespace mocoder {
+
+using namespace std;
+
+// 视图变换，屏幕坐标 = (世界坐标 - offset_) * scale_
+class Camera {
+ public:
+  static constexpr double kMinScale = 0.05;
+  static constexpr double kMaxScale = 8;
+
+  // 屏幕左上角对应的世界坐标
+  Vec2d offset_;
+  double scale_ = 1;
+
+  Vec2d ToWorld(Vec2d p) const {
+    return Vec2d(p.x / scale_ + offset_.x, p.y / scale_ + offset_.y);
+  }
+
+  Vec2d ToScreen(Vec2d p) const {
+    return Vec2d((p.x - offset_.x) * scale_, (p.y - offset_.y) * scale_);
+  }
+
+  Box ToWorld(const Box& b) const {
+    return Box(ToWorld(b.pos_), Vec2d(b.size_.x / scale_, b.size_.y / scale_));
+  }
+
+  Box ToScreen(const Box& b) const {
+    return Box(ToScreen(b.pos_), Vec2d(b.size_.x * scale_, b.size_.y * scale_));
+  }
+
+  // 以屏幕上的点anchor为中心缩放，anchor下的世界坐标保持不变
+  void ZoomAt(Vec2d anchor, double factor) {
+    Vec2d world = ToWorld(anchor);
+    scale_ = clamp(scale_ * factor, kMinScale, kMaxScale);
+    offset_ = Vec2d(world.x - anchor.x / scale_, world.y - anchor.y / scale_);
+  }
+
+  // 按屏幕上的位移平移画面
+  void Pan(Vec2d delta) {
+    offset_ = Vec2d(offset_.x - delta.x / scale_, offset_.y - delta.y / scale_);
+  }
+
+  // 之后在canvas上按世界坐标绘制
+  void Apply(SkCanvas* canvas) const {
+    canvas->scale(scale_, scale_);
+    canvas->translate(-offset_.x, -offset_.y);
+  }
+};
+
+}  // namespace mocoder
@@ -0,0 +1,89 @@
+/**
+ * @file damage.h
+ * @author MCMocoder (mcmocoder@ametav.com)
+ * @brief
+ * @version 0.1
+ * @date 2023-06-14
+ *
+ * @copyright Copyright (c) 2023 Mocoder Studio
+ *
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "utils/box.h"
+#include "utils/camera.h"
+
+namespace mocoder {
+
+using namespace std;
+
+// 记录需要重绘的区域(屏幕坐标)，相交的矩形合并为一个，
+// 矩形过多时退化为它们的包围盒，使裁剪与查询的代价有上限
+class DamageTracker {
+ public:
+  static constexpr size_t kMaxRects = 8;
+
+  vector<Box> rects_;
+  // 将组件的世界坐标换算到屏幕，为空时两者相同
+  const Camera* camera_ = nullptr;
+  // 另行记录世界坐标的重绘区域，供小地图等按文档更新的缓存使用
+  DamageTracker* world_ = nullptr;
+
+  void AddWorld(const Box& box) {
+    Add(camera_ != nullptr ? camera_->ToScreen(box) : box);
+    if (world_ != nullptr) {
+      world_->Add(box);
+    }
+  }
+
+  void Add(Box box) {
+    if (!(box.size_.x >= 0 && box.size_.y >= 0)) {
+      return;
+    }
+    // 合并后的矩形可能又与其他矩形相交，故从头再找一遍
+    for (size_t i = 0; i < rects_.size();) {
+      if (rects_[i].Overlaps(box)) {
+        box = box.Join(rects_[i]);
+        rects_[i] = rects_.back();
+        rects_.pop_back();
+        i = 0;
+      } else {
+        ++i;
+      }
+    }
+    rects_.push_back(box);
+    if (rects_.size() > kMaxRects) {
+      Box bound = Bound();
+      rects_.assign(1, bound);
+    }
+  }
+
+  bool Empty() const { return rects_.empty(); }
+
+  void Clear() { rects_.clear(); }
+
+  bool Intersects(const Box& box) const {
+    for (auto& i : rects_) {
+      if (i.Overlaps(box)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  Box Bound() const {
+    if (rects_.empty()) {
+      return Box();
+    }
+    Box res = rects_[0];
+    for (auto& i : rects_) {
+      res = res.Join(i);
+    }
+    return res;
+  }
+};
+
+}  // namespace mocoder
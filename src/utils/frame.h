@@ -11,9 +11,17 @@
 
 #pragma once
 
+#include <chrono>
 #include <cstdint>
 namespace mocoder {
 
+// 单调时钟的当前时间，单位为秒
+inline double Now() {
+  return std::chrono::duration<double>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
 class FrameCounter {
  public:
   unsigned frame = 0;
@@ -0,0 +1,423 @@
+/**
+ * @file grid.h
+ * @author MCMocoder (mcmocoder@ametav.com)
+ * @brief
+ * @version 0.1
+ * @date 2023-06-12
+ *
+ * @copyright Copyright (c) 2023 Mocoder Studio
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+#include "utils/spatialindex.h"
+
+namespace mocoder {
+
+using namespace std;
+
+// 均匀哈希网格：平面按cell_划分，只为非空的格子分配桶，
+// 对象登记在其包围盒覆盖的每个格子中，适合大小相近、分布稠密的组件。
+// 对象的node_为记录下标。查询用记录上的标记去重，因此不可在visitor中嵌套查询
+class UniformGrid : public SpatialIndex {
+ public:
+  // 覆盖格子数超过此值的对象（如很长的箭头）单独存放，查询时逐个检查
+  static constexpr int64_t kMaxCells = 64;
+
+  struct Record {
+    BoxedObj* obj_ = nullptr;
+    int x0_ = 0, y0_ = 0, x1_ = 0, y1_ = 0;  // 覆盖的格子范围，闭区间
+    bool large_ = false;
+    uint32_t slot_ = 0;  // large_时为在large_中的下标
+    uint32_t mark_ = 0;
+  };
+
+  double cell_;
+  unordered_map<uint64_t, vector<uint32_t>> cells_;
+  vector<Record> records_;
+  vector<uint32_t> free_records_;
+  vector<uint32_t> large_;
+  vector<pair<double, uint32_t>> nn_heap_;
+  uint32_t mark_ = 0;
+  int obj_cnt_ = 0;
+  // 曾被占用过的格子范围，Clear时重置，用于限制最近邻的搜索圈数
+  int minx_, miny_, maxx_, maxy_;
+
+  UniformGrid(double cell = 128) : cell_(cell) { Clear(); }
+
+  ~UniformGrid() {
+    for (auto& r : records_) {
+      if (r.obj_ != nullptr && Contains(r.obj_)) {
+        r.obj_->index_ = nullptr;
+      }
+    }
+  }
+
+  void Clear() override {
+    ++epoch_;
+    cells_.clear();
+    records_.clear();
+    free_records_.clear();
+    large_.clear();
+    obj_cnt_ = 0;
+    minx_ = miny_ = numeric_limits<int>::max();
+    maxx_ = maxy_ = numeric_limits<int>::min();
+  }
+
+  void Insert(BoxedObj* obj) override {
+    if (Contains(obj)) {
+      return;
+    }
+    uint32_t id;
+    if (!free_records_.empty()) {
+      id = free_records_.back();
+      free_records_.pop_back();
+    } else {
+      id = records_.size();
+      records_.emplace_back();
+    }
+    records_[id] = Record();
+    records_[id].obj_ = obj;
+    Attach(obj);
+    obj->node_ = id;
+    ++obj_cnt_;
+    Register(id);
+  }
+
+  void Remove(BoxedObj* obj) override {
+    if (!Contains(obj)) {
+      return;
+    }
+    uint32_t id = obj->node_;
+    Unregister(id);
+    records_[id].obj_ = nullptr;
+    free_records_.push_back(id);
+    obj->index_ = nullptr;
+    --obj_cnt_;
+  }
+
+  // 仅在覆盖的格子范围改变时才重新登记
+  void Update(BoxedObj* obj) override {
+    if (!Contains(obj)) {
+      return;
+    }
+    uint32_t id = obj->node_;
+    Record& r = records_[id];
+    int x0, y0, x1, y1;
+    GetRange(obj->box_, x0, y0, x1, y1);
+    if (x0 == r.x0_ && y0 == r.y0_ && x1 == r.x1_ && y1 == r.y1_) {
+      return;
+    }
+    Unregister(id);
+    Register(id);
+  }
+
+  void Build(const vector<BoxedObj*>& objs) override {
+    Clear();
+    records_.reserve(objs.size());
+    cells_.reserve(objs.size());
+    for (auto i : objs) {
+      Insert(i);
+    }
+  }
+
+  int Count() override { return obj_cnt_; }
+
+  bool QueryOverlap(const Box& box, Visitor visit) override {
+    ++stats_.queries;
+    NextMark();
+    for (uint32_t id : large_) {
+      if (!Check(id, box, visit)) {
+        return false;
+      }
+    }
+    int x0, y0, x1, y1;
+    GetRange(box, x0, y0, x1, y1);
+    // 查询范围比已占用的格子还多时，直接遍历所有非空格子
+    if (CellCount(x0, y0, x1, y1) > (int64_t)cells_.size()) {
+      for (auto& [key, ids] : cells_) {
+        int x = (int)(int32_t)(key >> 32), y = (int)(int32_t)key;
+        if (x < x0 || x > x1 || y < y0 || y > y1) {
+          continue;
+        }
+        ++stats_.nodes;
+        for (uint32_t id : ids) {
+          if (!Check(id, box, visit)) {
+            return false;
+          }
+        }
+      }
+      return true;
+    }
+    for (int y = y0; y <= y1; ++y) {
+      for (int x = x0; x <= x1; ++x) {
+        auto it = cells_.find(GetKey(x, y));
+        if (it == cells_.end()) {
+          continue;
+        }
+        ++stats_.nodes;
+        for (uint32_t id : it->second) {
+          if (!Check(id, box, visit)) {
+            return false;
+          }
+        }
+      }
+    }
+    return true;
+  }
+
+  // 按DDA依次访问线段穿过的格子
+  bool QuerySegment(Vec2d p1, Vec2d p2, Visitor visit) override {
+    ++stats_.queries;
+    NextMark();
+    for (uint32_t id : large_) {
+      if (!CheckSegment(id, p1, p2, visit)) {
+        return false;
+      }
+    }
+    int cx = GetCoord(p1.x), cy = GetCoord(p1.y);
+    int ex = GetCoord(p2.x), ey = GetCoord(p2.y);
+    int64_t steps = (int64_t)abs(ex - cx) + abs(ey - cy) + 1;
+    if (steps > (int64_t)cells_.size()) {
+      for (auto& [key, ids] : cells_) {
+        int x = (int)(int32_t)(key >> 32), y = (int)(int32_t)key;
+        if (!SegmentHitsBox(p1, p2, x * cell_, y * cell_, (x + 1) * cell_,
+                            (y + 1) * cell_)) {
+          continue;
+        }
+        ++stats_.nodes;
+        for (uint32_t id : ids) {
+          if (!CheckSegment(id, p1, p2, visit)) {
+            return false;
+          }
+        }
+      }
+      return true;
+    }
+    double dx = p2.x - p1.x, dy = p2.y - p1.y;
+    double inf = numeric_limits<double>::infinity();
+    int sx = dx > 0 ? 1 : -1, sy = dy > 0 ? 1 : -1;
+    double tmaxx = dx == 0 ? inf : ((cx + (dx > 0)) * cell_ - p1.x) / dx;
+    double tmaxy = dy == 0 ? inf : ((cy + (dy > 0)) * cell_ - p1.y) / dy;
+    double tdeltax = dx == 0 ? inf : cell_ / fabs(dx);
+    double tdeltay = dy == 0 ? inf : cell_ / fabs(dy);
+    for (int64_t i = 0; i < steps; ++i) {
+      auto it = cells_.find(GetKey(cx, cy));
+      if (it != cells_.end()) {
+        ++stats_.nodes;
+        for (uint32_t id : it->second) {
+          if (!CheckSegment(id, p1, p2, visit)) {
+            return false;
+          }
+        }
+      }
+      if (cx == ex && cy == ey) {
+        break;
+      }
+      if (tmaxx < tmaxy) {
+        cx += sx;
+        tmaxx += tdeltax;
+      } else {
+        cy += sy;
+        tmaxy += tdeltay;
+      }
+    }
+    return true;
+  }
+
+  // 从p所在的格子向外逐圈搜索，第r圈之外的对象到p的距离至少为r*cell_，
+  // 因此每搜完一圈就可以按距离交出堆中不超过该下界的对象
+  bool QueryNearest(Vec2d p, double radius, NearestVisitor visit) override {
+    ++stats_.queries;
+    NextMark();
+    auto& heap = nn_heap_;
+    heap.clear();
+    auto cmp = [](const pair<double, uint32_t>& a,
+                  const pair<double, uint32_t>& b) { return a.first > b.first; };
+    int pushed = 0;
+    auto push = [&](uint32_t id) {
+      Record& r = records_[id];
+      if (r.mark_ == mark_) {
+        return;
+      }
+      r.mark_ = mark_;
+      ++pushed;
+      ++stats_.candidates;
+      double d = Distance(p, r.obj_->box_);
+      if (d <= radius) {
+        heap.push_back({d, id});
+        push_heap(heap.begin(), heap.end(), cmp);
+      }
+    };
+    auto pop = [&](double bound) {
+      while (!heap.empty() && heap.front().first <= bound) {
+        pop_heap(heap.begin(), heap.end(), cmp);
+        auto [d, id] = heap.back();
+        heap.pop_back();
+        ++stats_.hits;
+        if (!visit(records_[id].obj_, d)) {
+          return false;
+        }
+      }
+      return true;
+    };
+    auto scan = [&](int64_t x, int64_t y) {
+      auto it = cells_.find(GetKey(x, y));
+      if (it == cells_.end()) {
+        return;
+      }
+      ++stats_.nodes;
+      for (uint32_t id : it->second) {
+        push(id);
+      }
+    };
+
+    for (uint32_t id : large_) {
+      push(id);
+    }
+    int cx = GetCoord(p.x), cy = GetCoord(p.y);
+    int64_t rmax = 0;
+    if (!cells_.empty()) {
+      rmax = max({(int64_t)cx - minx_, (int64_t)maxx_ - cx,
+                  (int64_t)cy - miny_, (int64_t)maxy_ - cy, (int64_t)0});
+    }
+    if (radius / cell_ + 1 < rmax) {
+      rmax = (int64_t)(radius / cell_) + 1;
+    }
+    for (int64_t r = 0; r <= rmax; ++r) {
+      if (r == 0) {
+        scan(cx, cy);
+      } else {
+        for (int64_t x = cx - r; x <= cx + r; ++x) {
+          scan(x, cy - r);
+          scan(x, cy + r);
+        }
+        for (int64_t y = cy - r + 1; y <= cy + r - 1; ++y) {
+          scan(cx - r, y);
+          scan(cx + r, y);
+        }
+      }
+      if (!pop(r * cell_)) {
+        return false;
+      }
+      // 所有对象都已入堆，不必再向外搜索
+      if (pushed == obj_cnt_) {
+        break;
+      }
+    }
+    return pop(numeric_limits<double>::infinity());
+  }
+
+ private:
+  // 格子坐标限制在int范围内，远处的对象会挤在边缘的格子里
+  int GetCoord(double v) {
+    double c = floor(v / cell_);
+    c = min(max(c, (double)(numeric_limits<int>::min() / 2)),
+            (double)(numeric_limits<int>::max() / 2));
+    return (int)c;
+  }
+
+  static uint64_t GetKey(int64_t x, int64_t y) {
+    return ((uint64_t)(uint32_t)x << 32) | (uint32_t)y;
+  }
+
+  static int64_t CellCount(int x0, int y0, int x1, int y1) {
+    return ((int64_t)x1 - x0 + 1) * ((int64_t)y1 - y0 + 1);
+  }
+
+  void GetRange(const Box& box, int& x0, int& y0, int& x1, int& y1) {
+    x0 = GetCoord(box.pos_.x);
+    y0 = GetCoord(box.pos_.y);
+    x1 = GetCoord(box.pos_.x + box.size_.x);
+    y1 = GetCoord(box.pos_.y + box.size_.y);
+  }
+
+  void NextMark() {
+    if (++mark_ == 0) {
+      for (auto& r : records_) {
+        r.mark_ = 0;
+      }
+      mark_ = 1;
+    }
+  }
+
+  void Register(uint32_t id) {
+    Record& r = records_[id];
+    GetRange(r.obj_->box_, r.x0_, r.y0_, r.x1_, r.y1_);
+    r.large_ = CellCount(r.x0_, r.y0_, r.x1_, r.y1_) > kMaxCells;
+    if (r.large_) {
+      r.slot_ = large_.size();
+      large_.push_back(id);
+      return;
+    }
+    minx_ = min(minx_, r.x0_);
+    miny_ = min(miny_, r.y0_);
+    maxx_ = max(maxx_, r.x1_);
+    maxy_ = max(maxy_, r.y1_);
+    for (int y = r.y0_; y <= r.y1_; ++y) {
+      for (int x = r.x0_; x <= r.x1_; ++x) {
+        cells_[GetKey(x, y)].push_back(id);
+      }
+    }
+  }
+
+  void Unregister(uint32_t id) {
+    Record& r = records_[id];
+    if (r.large_) {
+      uint32_t last = large_.back();
+      large_[r.slot_] = last;
+      records_[last].slot_ = r.slot_;
+      large_.pop_back();
+      return;
+    }
+    for (int y = r.y0_; y <= r.y1_; ++y) {
+      for (int x = r.x0_; x <= r.x1_; ++x) {
+        auto it = cells_.find(GetKey(x, y));
+        auto& ids = it->second;
+        *find(ids.begin(), ids.end(), id) = ids.back();
+        ids.pop_back();
+        if (ids.empty()) {
+          cells_.erase(it);
+        }
+      }
+    }
+  }
+
+  bool Check(uint32_t id, const Box& box, Visitor& visit) {
+    Record& r = records_[id];
+    if (r.mark_ == mark_) {
+      return true;
+    }
+    r.mark_ = mark_;
+    ++stats_.candidates;
+    if (!r.obj_->box_.Overlaps(box)) {
+      return true;
+    }
+    ++stats_.hits;
+    return visit(r.obj_);
+  }
+
+  bool CheckSegment(uint32_t id, Vec2d p1, Vec2d p2, Visitor& visit) {
+    Record& r = records_[id];
+    if (r.mark_ == mark_) {
+      return true;
+    }
+    r.mark_ = mark_;
+    ++stats_.candidates;
+    if (!SegmentHitsBox(p1, p2, r.obj_->box_)) {
+      return true;
+    }
+    ++stats_.hits;
+    return visit(r.obj_);
+  }
+};
+
+}  // namespace mocoder
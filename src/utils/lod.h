@@ -0,0 +1,37 @@
+/**
+ * @file lod.h
+ * @author MCMocoder (mcmocoder@ametav.com)
+ * @brief
+ * @version 0.1
+ * @date 2023-06-21
+ *
+ * @copyright Copyright (c) 2023 Mocoder Studio
+ *
+ */
+
+#pragma once
+
+namespace mocoder {
+
+// 组件的细节等级，由画面缩放决定
+enum class Lod {
+  // 文字完整排版
+  FULL,
+  // 文字已不可读，沿用上次排版结果的低分辨率图像
+  IMAGE,
+  // 文字画成灰条，外形画成填充的盒子
+  GREEK
+};
+
+// 24号字缩放后不足12像素时不再排版，不足6像素时只画轮廓
+constexpr double kLegibleScale = 0.5;
+constexpr double kGreekScale = 0.25;
+
+inline Lod LodForScale(double scale) {
+  if (scale >= kLegibleScale) {
+    return Lod::FULL;
+  }
+  return scale >= kGreekScale ? Lod::IMAGE : Lod::GREEK;
+}
+
+}  // namespace mocoder
@@ -0,0 +1,200 @@
+/**
+ * @file minimaptiles.h
+ * @author MCMocoder (mcmocoder@ametav.com)
+ * @brief
+ * @version 0.1
+ * @date 2023-06-22
+ *
+ * @copyright Copyright (c) 2023 Mocoder Studio
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <map>
+#include <utility>
+
+#include "utils/box.h"
+
+#define SK_GANESH
+#define SK_GL
+#include "include/core/SkCanvas.h"
+#include "include/core/SkImage.h"
+#include "include/core/SkSamplingOptions.h"
+#include "include/core/SkSurface.h"
+#include "include/gpu/GrDirectContext.h"
+
+namespace mocoder {
+
+using namespace std;
+
+// 文档的低分辨率分块缓存，只有一层。level为每像素对应2^level个世界单位，
+// 取恰好能将文档以目标尺寸显示的值，分块数不超过kMaxTiles；
+// 文档尺寸跨过2的幂时换用新的level重建。组件变化时只重绘分块中变脏的部分
+class MinimapTiles {
+ public:
+  static constexpr int kTileSize = 256;
+  static constexpr int kMaxTiles = 16;
+  // 文档很小时也不再放大
+  static constexpr int kMinLevel = 1;
+
+  // 在以世界坐标为单位的canvas上绘制指定的世界范围
+  using DrawFunc = function<void(SkCanvas*, const Box&)>;
+
+  struct Tile {
+    sk_sp<SkImage> image;
+    // 需要重绘的世界坐标范围
+    Box dirty;
+    bool has_dirty = false;
+  };
+
+  int level_ = kMinLevel;
+  // 按(列, 行)索引的分块与其下标范围
+  map<pair<int, int>, Tile> tiles_;
+  SkIRect range_ = SkIRect::MakeEmpty();
+  GrDirectContext* context_ = nullptr;
+
+  static double Scale(int level) { return ldexp(1.0, -level); }
+
+  // 一块覆盖的世界坐标边长
+  static double Extent(int level) { return kTileSize / Scale(level); }
+
+  static Box TileBox(int level, int x, int y) {
+    double e = Extent(level);
+    return Box(Vec2d(x * e, y * e), Vec2d(e, e));
+  }
+
+  // 与box相交的分块下标范围，右下不含
+  static SkIRect TileRange(int level, const Box& box) {
+    double e = Extent(level);
+    return SkIRect::MakeLTRB(floor(box.pos_.x / e), floor(box.pos_.y / e),
+                             floor((box.pos_.x + box.size_.x) / e) + 1,
+                             floor((box.pos_.y + box.size_.y) / e) + 1);
+  }
+
+  // 能以不小于w×h像素显示bound的最大level
+  static int LevelFor(const Box& bound, double w, double h) {
+    double fit = min(w / max(bound.size_.x, 1.0), h / max(bound.size_.y, 1.0));
+    int level = max(kMinLevel, (int)floor(-log2(fit)));
+    while (true) {
+      SkIRect r = TileRange(level, bound);
+      if ((int64_t)r.width() * r.height() <= kMaxTiles) {
+        return level;
+      }
+      ++level;
+    }
+  }
+
+  // 与box相交的分块在下次Update时重绘相交的部分
+  void MarkDirty(const Box& box) {
+    SkIRect r = TileRange(level_, box);
+    if (!r.intersect(range_)) {
+      return;
+    }
+    for (int y = r.top(); y < r.bottom(); ++y) {
+      for (int x = r.left(); x < r.right(); ++x) {
+        auto it = tiles_.find({x, y});
+        if (it == tiles_.end()) {
+          continue;
+        }
+        Tile& tile = it->second;
+        tile.dirty = tile.has_dirty ? tile.dirty.Join(box) : box;
+        tile.has_dirty = true;
+      }
+    }
+  }
+
+  // 按bound与目标尺寸w×h选定level，补齐缺失的分块并重绘变脏的部分
+  void Update(const Box& bound, double w, double h, const DrawFunc& draw) {
+    int level = LevelFor(bound, w, h);
+    if (level != level_) {
+      tiles_.clear();
+      level_ = level;
+    }
+    range_ = TileRange(level_, bound);
+    erase_if(tiles_, [this](const auto& i) {
+      return !range_.contains(i.first.first, i.first.second);
+    });
+    double scale = Scale(level_);
+    for (int y = range_.top(); y < range_.bottom(); ++y) {
+      for (int x = range_.left(); x < range_.right(); ++x) {
+        Tile& tile = tiles_[{x, y}];
+        if (tile.image != nullptr && !tile.has_dirty) {
+          continue;
+        }
+        sk_sp<SkSurface> surface = MakeSurface();
+        if (surface == nullptr) {
+          return;
+        }
+        SkCanvas* c = surface->getCanvas();
+        Box world = TileBox(level_, x, y);
+        // 重绘范围取整到像素，再换回世界坐标交给draw查询
+        SkIRect pixels = SkIRect::MakeWH(kTileSize, kTileSize);
+        if (tile.image != nullptr) {
+          c->drawImage(tile.image, 0, 0);
+          Box part = tile.dirty.Intersect(world);
+          SkRect r = SkRect::MakeXYWH((part.pos_.x - world.pos_.x) * scale,
+                                      (part.pos_.y - world.pos_.y) * scale,
+                                      part.size_.x * scale,
+                                      part.size_.y * scale);
+          pixels = r.roundOut();
+          if (!pixels.intersect(SkIRect::MakeWH(kTileSize, kTileSize))) {
+            tile.has_dirty = false;
+            continue;
+          }
+        }
+        Box area(Vec2d(world.pos_.x + pixels.x() / scale,
+                       world.pos_.y + pixels.y() / scale),
+                 Vec2d(pixels.width() / scale, pixels.height() / scale));
+        c->save();
+        c->clipIRect(pixels);
+        c->clear(SK_ColorWHITE);
+        c->scale(scale, scale);
+        c->translate(-world.pos_.x, -world.pos_.y);
+        draw(c, area);
+        c->restore();
+        tile.image = surface->makeImageSnapshot();
+        tile.has_dirty = false;
+      }
+    }
+  }
+
+  // 将世界范围src画到dst，每块一次drawImageRect
+  void Draw(SkCanvas* canvas, const Box& src, const SkRect& dst) {
+    double scale = dst.width() / src.size_.x;
+    SkSamplingOptions sampling(SkFilterMode::kLinear, SkMipmapMode::kLinear);
+    canvas->save();
+    canvas->clipRect(dst);
+    for (auto& [key, tile] : tiles_) {
+      Box box = TileBox(level_, key.first, key.second);
+      if (tile.image == nullptr || !box.Overlaps(src)) {
+        continue;
+      }
+      canvas->drawImageRect(
+          tile.image,
+          SkRect::MakeXYWH(dst.x() + (box.pos_.x - src.pos_.x) * scale,
+                           dst.y() + (box.pos_.y - src.pos_.y) * scale,
+                           box.size_.x * scale, box.size_.y * scale),
+          sampling);
+    }
+    canvas->restore();
+  }
+
+  void Reset() {
+    tiles_.clear();
+    range_ = SkIRect::MakeEmpty();
+  }
+
+ private:
+  sk_sp<SkSurface> MakeSurface() {
+    SkImageInfo info = SkImageInfo::MakeN32Premul(kTileSize, kTileSize);
+    return context_ != nullptr
+               ? SkSurface::MakeRenderTarget(context_, SkBudgeted::kNo, info)
+               : SkSurface::MakeRaster(info);
+  }
+};
+
+}  // namespace mocoder
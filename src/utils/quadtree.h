@@ -11,175 +11,748 @@
 
 #pragma once
 
-#include <memory>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
 #include <vector>
 
-#include "utils/boxedobj.h"
+#include "utils/spatialindex.h"
 
 namespace mocoder {
 
 using namespace std;
 
-class QuadTreeNode {
+// 节点与对象都存放在连续的池中，以32位下标互相引用
+// 对象的node_为所在节点下标，item_为对象槽下标
+class QuadTree : public SpatialIndex {
  public:
+  static constexpr uint32_t kNull = UINT32_MAX;
+
+  struct Node {
+    Box bound_;
+    Box objbound_;  // 本节点对象的包围盒，只增不减，链表清空或重排时重算
+    uint32_t parent_ = kNull;
+    uint32_t child_ = kNull;  // 四个子节点在池中连续存放，child_为第一个
+    uint32_t first_ = kNull;  // 本节点对象链表的表头
+    uint32_t count_ = 0;
+    bool IsLeaf() const { return child_ == kNull; }
+  };
+
+  struct Item {
+    BoxedObj* obj_ = nullptr;
+    uint32_t prev_ = kNull;
+    uint32_t next_ = kNull;
+  };
+
   Box bound_;
-  shared_ptr<QuadTreeNode> nodes_[4];
-  vector<BoxedObj*> obj_;
+  vector<Node> nodes_;
+  vector<Item> items_;
+  uint32_t node_cnt_ = 0;
+  uint32_t item_cnt_ = 0;
+  uint32_t free_nodes_ = kNull;  // 空闲的四节点块，以child_串联
+  uint32_t free_items_ = kNull;  // 空闲的对象槽，以next_串联
+  int obj_cnt_ = 0;
+
+  // 叶子的对象数超过capacity_时分裂，深度达到max_depth_的节点不再分裂，根的深度为0
+  uint32_t capacity_ = 6;
+  int max_depth_ = 16;
+  // 开启后Maintain根据最近的查询统计调整capacity_与max_depth_
+  bool auto_tune_ = false;
+  static constexpr uint64_t kTuneWindow = 1024;  // 每隔多少次查询评估一次
+  QueryStats tune_base_;                         // 上次评估时的查询统计
+  uint32_t prev_capacity_ = 0;  // 试探前的容量，0表示没有进行中的试探
+  double prev_cost_ = 0;        // 试探前每次查询的代价
+  int tune_dir_ = -1;           // 下次试探的方向，-1减半，1加倍
+  int idle_windows_ = 0;        // 试探失败后暂停评估的窗口数
+
+  struct TreeStats {
+    int nodes = 0;
+    int leaves = 0;
+    int depth = 0;              // 最大深度
+    vector<int> depth_hist;     // 各深度的节点数
+    vector<int> objs;           // 各深度节点上的对象数
+    vector<int> straddlers;     // 各深度停在非叶节点上（跨越了中线）的对象数
+  };
+
+  struct NearestEntry {
+    double dist;
+    uint32_t index;  // is_obj时为对象槽下标，否则为节点下标
+    bool is_obj;
+    double minx, miny, maxx, maxy;
+  };
+  vector<NearestEntry> nn_heap_;
+
+  QuadTree(Box bound) : bound_(bound) { Clear(); }
+
+  ~QuadTree() {
+    for (uint32_t i = 0; i < item_cnt_; ++i) {
+      if (items_[i].obj_ != nullptr && Contains(items_[i].obj_)) {
+        items_[i].obj_->index_ = nullptr;
+      }
+    }
+  }
 
-  QuadTreeNode(Box bound) : bound_(bound) {
-    for (int i = 0; i < 4; ++i) {
-      nodes_[i] = shared_ptr<QuadTreeNode>(nullptr);
+  // 不释放池内存，只重置使用计数，复杂度O(1)
+  void Clear() override {
+    ++epoch_;
+    if (nodes_.empty()) {
+      nodes_.resize(1);
     }
+    nodes_[0] = Node();
+    nodes_[0].bound_ = bound_;
+    node_cnt_ = 1;
+    item_cnt_ = 0;
+    free_nodes_ = kNull;
+    free_items_ = kNull;
+    obj_cnt_ = 0;
   }
 
-  int GetBoxPos(BoxedObj* obj) {
-    double xmid = bound_.pos_.x + bound_.size_.x / 2;
-    double ymid = bound_.pos_.y + bound_.size_.y / 2;
+  // 0:左上 1:右上 2:左下 3:右下，跨越中线时返回-1
+  static int GetBoxPos(const Box& bound, const Box& box) {
+    double xmid = bound.pos_.x + bound.size_.x / 2;
+    double ymid = bound.pos_.y + bound.size_.y / 2;
 
-    bool is_left = (obj->box_.pos_.x + obj->box_.size_.x < xmid);
-    bool is_right = (obj->box_.pos_.x > xmid);
-    bool is_down = (obj->box_.pos_.y + obj->box_.size_.y < ymid);
-    bool is_up = (obj->box_.pos_.y > ymid);
+    bool is_left = (box.pos_.x + box.size_.x < xmid);
+    bool is_right = (box.pos_.x > xmid);
+    bool is_top = (box.pos_.y + box.size_.y < ymid);
+    bool is_bottom = (box.pos_.y > ymid);
+
+    if ((!is_left && !is_right) || (!is_top && !is_bottom)) {
+      return -1;
+    }
+    return (is_right ? 1 : 0) + (is_bottom ? 2 : 0);
+  }
 
-    if (is_left) {
-      if (is_up) {
-        return 0;
-      } else if (is_down) {
-        return 2;
+  // 返回插入obj时obj最终所在的节点，depth不为空时写入该节点的深度
+  uint32_t Locate(BoxedObj* obj, int* depth = nullptr) {
+    uint32_t n = 0;
+    int d = 0;
+    while (!nodes_[n].IsLeaf()) {
+      int pos = GetBoxPos(nodes_[n].bound_, obj->box_);
+      if (pos == -1) {
+        break;
       }
+      n = nodes_[n].child_ + pos;
+      ++d;
+    }
+    if (depth != nullptr) {
+      *depth = d;
     }
+    return n;
+  }
 
-    if (is_right) {
-      if (is_up) {
-        return 1;
-      } else if (is_down) {
-        return 3;
+  void Insert(BoxedObj* obj) override {
+    if (Contains(obj)) {
+      return;
+    }
+    Grow(obj->box_);
+    int depth;
+    uint32_t n = Locate(obj, &depth);
+    Link(n, AllocItem(obj));
+    if (nodes_[n].IsLeaf() && nodes_[n].count_ > capacity_ &&
+        depth < max_depth_) {
+      Split(n, depth);
+    }
+  }
+
+  void Remove(BoxedObj* obj) override {
+    if (!Contains(obj)) {
+      return;
+    }
+    uint32_t n = obj->node_;
+    Unlink(n, obj->item_);
+    FreeItem(obj->item_);
+    obj->index_ = nullptr;
+    for (n = nodes_[n].parent_; n != kNull; n = nodes_[n].parent_) {
+      Merge(n);
+    }
+  }
+
+  // 仅在obj所属节点改变时才移动
+  void Update(BoxedObj* obj) override {
+    if (!Contains(obj)) {
+      return;
+    }
+    Grow(obj->box_);
+    if (Locate(obj) == obj->node_) {
+      Node& node = nodes_[obj->node_];
+      node.objbound_ = Union(node.objbound_, obj->box_);
+      return;
+    }
+    Remove(obj);
+    Insert(obj);
+  }
+
+  int Count() override { return obj_cnt_; }
+
+  // 修改分裂策略后按新策略重建整棵树
+  void SetPolicy(uint32_t capacity, int max_depth) {
+    capacity_ = max(capacity, 1u);
+    max_depth_ = clamp(max_depth, 1, kKeyLevels);
+    Rebuild();
+  }
+
+  void Rebuild() {
+    vector<BoxedObj*> objs;
+    objs.reserve(obj_cnt_);
+    for (uint32_t i = 0; i < item_cnt_; ++i) {
+      if (items_[i].obj_ != nullptr) {
+        objs.push_back(items_[i].obj_);
       }
     }
+    Build(objs);
+  }
 
-    return -1;
+  // 以每次查询访问的节点数与检查的对象数之和为代价，对容量做爬山搜索：
+  // 每隔一个窗口向tune_dir_方向试探一次，下个窗口代价变高则退回并换向，
+  // 之后暂停若干窗口。深度上限随对象数对数增长并留有余量，
+  // 防止退化输入使树无限加深
+  void Maintain() override {
+    if (!auto_tune_ || stats_.queries - tune_base_.queries < kTuneWindow) {
+      return;
+    }
+    double cost = (double)(stats_.nodes - tune_base_.nodes +
+                           stats_.candidates - tune_base_.candidates) /
+                  (stats_.queries - tune_base_.queries);
+    tune_base_ = stats_;
+
+    uint32_t capacity = capacity_;
+    if (prev_capacity_ != 0) {
+      if (cost > prev_cost_) {
+        capacity = prev_capacity_;
+        tune_dir_ = -tune_dir_;
+        idle_windows_ = 16;
+      }
+      prev_capacity_ = 0;
+    } else if (idle_windows_ > 0) {
+      --idle_windows_;
+    } else {
+      uint32_t next = tune_dir_ < 0 ? capacity_ / 2 : capacity_ * 2;
+      if (next >= 1 && next <= 64 && next != capacity_) {
+        prev_capacity_ = capacity_;
+        prev_cost_ = cost;
+        capacity = next;
+      } else {
+        tune_dir_ = -tune_dir_;
+      }
+    }
+    double leaves = max(obj_cnt_, 1) / (double)capacity;
+    int depth = clamp((int)ceil(log(max(leaves, 1.0)) / log(4.0)) + 6, 4,
+                      kKeyLevels);
+    if (capacity != capacity_ || depth != max_depth_) {
+      SetPolicy(capacity, depth);
+    }
   }
 
-  int GetBoxPos(Box box) {
-    double xmid = bound_.pos_.x + bound_.size_.x / 2;
-    double ymid = bound_.pos_.y + bound_.size_.y / 2;
+  TreeStats GetTreeStats() {
+    TreeStats res;
+    vector<pair<uint32_t, int>> stack = {{0, 0}};
+    while (!stack.empty()) {
+      auto [n, depth] = stack.back();
+      stack.pop_back();
+      const Node& node = nodes_[n];
+      if (depth >= (int)res.depth_hist.size()) {
+        res.depth_hist.resize(depth + 1);
+        res.objs.resize(depth + 1);
+        res.straddlers.resize(depth + 1);
+      }
+      ++res.nodes;
+      ++res.depth_hist[depth];
+      res.objs[depth] += node.count_;
+      res.depth = max(res.depth, depth);
+      if (node.IsLeaf()) {
+        ++res.leaves;
+        continue;
+      }
+      res.straddlers[depth] += node.count_;
+      for (uint32_t i = node.child_; i < node.child_ + 4; ++i) {
+        stack.push_back({i, depth + 1});
+      }
+    }
+    return res;
+  }
 
-    bool is_left = (box.pos_.x + box.size_.x < xmid);
-    bool is_right = (box.pos_.x > xmid);
-    bool is_down = (box.pos_.y + box.size_.y < ymid);
-    bool is_up = (box.pos_.y > ymid);
+  // 对象超出根节点时，向对象所在方向把根节点边长加倍，原根节点成为新根的一个子节点，
+  // 因此画布可以无限扩展，而查询代价只随树高对数增长
+  void Grow(const Box& box) {
+    if (!isfinite(box.pos_.x) || !isfinite(box.pos_.y) ||
+        !isfinite(box.size_.x) || !isfinite(box.size_.y)) {
+      return;
+    }
+    if (bound_.size_.x <= 0 || bound_.size_.y <= 0) {
+      bound_.size_ = Vec2d(max(bound_.size_.x, 1.0), max(bound_.size_.y, 1.0));
+      nodes_[0].bound_ = bound_;
+    }
+    while (!InBound(bound_, box)) {
+      bool grow_left = box.pos_.x < bound_.pos_.x;
+      bool grow_up = box.pos_.y < bound_.pos_.y;
+      int q = (grow_left ? 1 : 0) + (grow_up ? 2 : 0);
+      Box bound(bound_.pos_ - Vec2d(grow_left ? bound_.size_.x : 0,
+                                    grow_up ? bound_.size_.y : 0),
+                bound_.size_ * 2.0);
+      bound_ = bound;
+      if (obj_cnt_ == 0) {
+        nodes_[0].bound_ = bound;
+        continue;
+      }
+
+      uint32_t c = AllocNodes();
+      Vec2d half = bound_.size_ / 2;
+      for (int i = 0; i < 4; ++i) {
+        nodes_[c + i].bound_ =
+            Box(bound_.pos_ + Vec2d(i & 1 ? half.x : 0, i & 2 ? half.y : 0),
+                half);
+        nodes_[c + i].parent_ = 0;
+      }
+      Node& old = nodes_[c + q];
+      old = nodes_[0];
+      old.parent_ = 0;
+      if (!old.IsLeaf()) {
+        for (uint32_t i = old.child_; i < old.child_ + 4; ++i) {
+          nodes_[i].parent_ = c + q;
+        }
+      }
+      nodes_[0] = Node();
+      nodes_[0].bound_ = bound_;
+      nodes_[0].child_ = c;
+
+      // 原根节点上的对象若跨越了新根的中线，则应留在新根上
+      for (uint32_t i = nodes_[c + q].first_; i != kNull;) {
+        uint32_t next = items_[i].next_;
+        BoxedObj* obj = items_[i].obj_;
+        obj->node_ = c + q;
+        if (GetBoxPos(bound_, obj->box_) != q) {
+          Unlink(c + q, i);
+          Link(0, i);
+        }
+        i = next;
+      }
+      RecalcObjBound(c + q);
+    }
+  }
+
+  // 批量建树：先求出每个对象从根到所在节点的象限路径键，
+  // 再自顶向下按路径键逐层分桶（即只排到所需深度的基数排序），
+  // 同一子树的对象因此连续，一次建成，对象不会在节点间反复移动
+  void Build(const vector<BoxedObj*>& objs) override {
+    Clear();
+    for (auto i : objs) {
+      Grow(i->box_);
+    }
+    vector<pair<uint64_t, BoxedObj*>> keys, tmp(objs.size());
+    keys.reserve(objs.size());
+    for (auto i : objs) {
+      keys.push_back({GetPathKey(i->box_), i});
+    }
+    // 对象槽按分桶后的顺序分配，每个节点的对象链表在池中连续
+    item_cnt_ = keys.size();
+    if (items_.size() < item_cnt_) {
+      items_.resize(item_cnt_);
+    }
+    obj_cnt_ = item_cnt_;
+    nodes_.reserve(objs.size() / 2 + 1);
+    Build(0, keys.data(), tmp.data(), 0, keys.size(), 0);
+  }
 
-    if (is_left) {
-      if (is_up) {
-        return 0;
-      } else if (is_down) {
-        return 2;
+  // 返回所在节点可能与box相交的对象，不逐个检查包围盒，查询过程不分配内存
+  bool Query(const Box& box, Visitor visit) {
+    ++stats_.queries;
+    return Query<false>(0, box, visit);
+  }
+
+  bool QueryOverlap(const Box& box, Visitor visit) override {
+    ++stats_.queries;
+    return Query<true>(0, box, visit);
+  }
+
+  // 只访问线段p1->p2穿过的节点
+  bool QuerySegment(Vec2d p1, Vec2d p2, Visitor visit) override {
+    ++stats_.queries;
+    double inf = numeric_limits<double>::infinity();
+    return QuerySegment(0, p1, p2, -inf, -inf, inf, inf, visit);
+  }
+
+  // 节点与对象放在同一个最小堆中，堆复用成员缓冲区，稳定后不分配内存
+  bool QueryNearest(Vec2d p, double radius, NearestVisitor visit) override {
+    ++stats_.queries;
+    double inf = numeric_limits<double>::infinity();
+    auto& heap = nn_heap_;
+    auto cmp = [](const NearestEntry& a, const NearestEntry& b) {
+      return a.dist > b.dist;
+    };
+    heap.clear();
+    heap.push_back({0.0, 0, false, -inf, -inf, inf, inf});
+    while (!heap.empty()) {
+      pop_heap(heap.begin(), heap.end(), cmp);
+      NearestEntry e = heap.back();
+      heap.pop_back();
+      if (e.dist > radius) {
+        break;
+      }
+      if (e.is_obj) {
+        ++stats_.hits;
+        if (!visit(items_[e.index].obj_, e.dist)) {
+          return false;
+        }
+        continue;
+      }
+      const Node& node = nodes_[e.index];
+      ++stats_.nodes;
+      for (uint32_t i = node.first_; i != kNull; i = items_[i].next_) {
+        ++stats_.candidates;
+        double d = Distance(p, items_[i].obj_->box_);
+        if (d <= radius) {
+          heap.push_back({d, i, true, 0, 0, 0, 0});
+          push_heap(heap.begin(), heap.end(), cmp);
+        }
+      }
+      if (node.IsLeaf()) {
+        continue;
+      }
+      double xmid = node.bound_.pos_.x + node.bound_.size_.x / 2;
+      double ymid = node.bound_.pos_.y + node.bound_.size_.y / 2;
+      double region[4][4] = {{e.minx, e.miny, xmid, ymid},
+                              {xmid, e.miny, e.maxx, ymid},
+                              {e.minx, ymid, xmid, e.maxy},
+                              {xmid, ymid, e.maxx, e.maxy}};
+      for (int i = 0; i < 4; ++i) {
+        double* r = region[i];
+        double d = Distance(p, r[0], r[1], r[2], r[3]);
+        if (d <= radius) {
+          heap.push_back({d, node.child_ + i, false, r[0], r[1], r[2], r[3]});
+          push_heap(heap.begin(), heap.end(), cmp);
+        }
       }
     }
+    return true;
+  }
+
+  void Retrieve(const Box& box, vector<BoxedObj*>& out) {
+    Query(box, [&out](BoxedObj* obj) {
+      out.push_back(obj);
+      return true;
+    });
+  }
+
+ private:
+  // 路径键每层占3位，0表示对象停在该层，1~4表示进入的象限，
+  // 因此排序后停在某节点的对象排在其四个子树之前
+  static constexpr int kKeyLevels = 21;
 
-    if (is_right) {
-      if (is_up) {
-        return 1;
-      } else if (is_down) {
-        return 3;
+  // 与逐层调用GetBoxPos等价，展开成无分支的比较以便批量计算
+  uint64_t GetPathKey(const Box& box) {
+    double x0 = box.pos_.x, x1 = box.pos_.x + box.size_.x;
+    double y0 = box.pos_.y, y1 = box.pos_.y + box.size_.y;
+    double bx = bound_.pos_.x, by = bound_.pos_.y;
+    double hw = bound_.size_.x / 2, hh = bound_.size_.y / 2;
+    uint64_t key = 0;
+    for (int level = 0; level < kKeyLevels; ++level) {
+      double xmid = bx + hw, ymid = by + hh;
+      int is_left = x1 < xmid, is_right = x0 > xmid;
+      int is_top = y1 < ymid, is_bottom = y0 > ymid;
+      if (!((is_left | is_right) & (is_top | is_bottom))) {
+        break;
       }
+      key |= (uint64_t)(is_right + 2 * is_bottom + 1)
+             << (3 * (kKeyLevels - 1 - level));
+      bx += is_right * hw;
+      by += is_bottom * hh;
+      hw /= 2;
+      hh /= 2;
     }
+    return key;
+  }
 
-    return -1;
+  static int GetKeyDigit(uint64_t key, int level) {
+    return (key >> (3 * (kKeyLevels - 1 - level))) & 7;
   }
 
-  void Split() {
-    nodes_[0] = make_shared<QuadTreeNode>(
-        QuadTreeNode(Box(bound_.pos_, bound_.size_ / 2)));
-    nodes_[1] = make_shared<QuadTreeNode>(QuadTreeNode(
-        Box(bound_.pos_ + Vec2d(bound_.size_.x / 2, 0), bound_.size_ / 2)));
-    nodes_[2] = make_shared<QuadTreeNode>(QuadTreeNode(
-        Box(bound_.pos_ + Vec2d(0, bound_.size_.y / 2), bound_.size_ / 2)));
-    nodes_[3] = make_shared<QuadTreeNode>(
-        QuadTreeNode(Box(bound_.pos_ + bound_.size_ / 2, bound_.size_ / 2)));
+  void Build(uint32_t n, pair<uint64_t, BoxedObj*>* keys,
+             pair<uint64_t, BoxedObj*>* tmp, uint32_t begin, uint32_t end,
+             int level) {
+    if (end - begin <= capacity_ || level >= max_depth_) {
+      LinkRange(n, keys, begin, end);
+      return;
+    }
+    uint32_t offset[6] = {0};
+    for (uint32_t i = begin; i < end; ++i) {
+      ++offset[GetKeyDigit(keys[i].first, level) + 1];
+    }
+    if (offset[1] == end - begin) {
+      LinkRange(n, keys, begin, end);
+      return;
+    }
+    offset[0] = begin;
+    for (int d = 1; d < 6; ++d) {
+      offset[d] += offset[d - 1];
+    }
+    uint32_t cursor[5];
+    copy(offset, offset + 5, cursor);
+    for (uint32_t i = begin; i < end; ++i) {
+      tmp[cursor[GetKeyDigit(keys[i].first, level)]++] = keys[i];
+    }
+    copy(tmp + begin, tmp + end, keys + begin);
+
+    LinkRange(n, keys, offset[0], offset[1]);
+    uint32_t c = AddChildren(n);
+    for (int pos = 0; pos < 4; ++pos) {
+      Build(c + pos, keys, tmp, offset[pos + 1], offset[pos + 2], level + 1);
+    }
+  }
 
-    for (auto i = obj_.begin(); i != obj_.end();) {
-      int pos = GetBoxPos(*i);
-      if (pos != -1) {
-        nodes_[pos]->Insert(*i);
-        i = obj_.erase(i);
-      } else {
-        ++i;
+  // 节点n能容纳的对象位于[minx, maxx]x[miny, maxy]内，根节点为整个平面
+  bool QuerySegment(uint32_t n, Vec2d p1, Vec2d p2, double minx, double miny,
+                    double maxx, double maxy, Visitor& visit) {
+    if (!SegmentHitsBox(p1, p2, minx, miny, maxx, maxy)) {
+      return true;
+    }
+    const Node& node = nodes_[n];
+    ++stats_.nodes;
+    if (node.count_ != 0 && SegmentHitsBox(p1, p2, node.objbound_)) {
+      for (uint32_t i = node.first_; i != kNull; i = items_[i].next_) {
+        BoxedObj* obj = items_[i].obj_;
+        ++stats_.candidates;
+        if (!SegmentHitsBox(p1, p2, obj->box_)) {
+          continue;
+        }
+        ++stats_.hits;
+        if (!visit(obj)) {
+          return false;
+        }
       }
     }
+    if (node.IsLeaf()) {
+      return true;
+    }
+    double xmid = node.bound_.pos_.x + node.bound_.size_.x / 2;
+    double ymid = node.bound_.pos_.y + node.bound_.size_.y / 2;
+    uint32_t c = node.child_;
+    return QuerySegment(c, p1, p2, minx, miny, xmid, ymid, visit) &&
+           QuerySegment(c + 1, p1, p2, xmid, miny, maxx, ymid, visit) &&
+           QuerySegment(c + 2, p1, p2, minx, ymid, xmid, maxy, visit) &&
+           QuerySegment(c + 3, p1, p2, xmid, ymid, maxx, maxy, visit);
+  }
+
+  // 将下标为[begin, end)的对象槽串成节点n的链表
+  void LinkRange(uint32_t n, pair<uint64_t, BoxedObj*>* keys, uint32_t begin,
+                 uint32_t end) {
+    Node& node = nodes_[n];
+    for (uint32_t i = begin; i < end; ++i) {
+      BoxedObj* obj = keys[i].second;
+      Item& item = items_[i];
+      item.obj_ = obj;
+      item.prev_ = i == begin ? kNull : i - 1;
+      item.next_ = i + 1 == end ? kNull : i + 1;
+      Attach(obj);
+      obj->node_ = n;
+      obj->item_ = i;
+      node.objbound_ = i == begin ? obj->box_ : Union(node.objbound_, obj->box_);
+    }
+    if (begin != end) {
+      node.first_ = begin;
+      node.count_ = end - begin;
+    }
   }
 
-  void Clear() {
-    obj_.clear();
-    for (int i = 0; i < 4; ++i) {
-      if (nodes_[i] != nullptr) {
-        nodes_[i]->Clear();
-        nodes_[i].reset();
+  uint32_t AllocNodes() {
+    uint32_t c;
+    if (free_nodes_ != kNull) {
+      c = free_nodes_;
+      free_nodes_ = nodes_[c].child_;
+    } else {
+      c = node_cnt_;
+      node_cnt_ += 4;
+      if (nodes_.size() < node_cnt_) {
+        nodes_.resize(node_cnt_);
       }
     }
+    for (uint32_t i = c; i < c + 4; ++i) {
+      nodes_[i] = Node();
+    }
+    return c;
+  }
+
+  void FreeNodes(uint32_t c) {
+    nodes_[c].child_ = free_nodes_;
+    free_nodes_ = c;
   }
 
-  void Insert(BoxedObj* obj) {
-    if (nodes_[0] == nullptr) {
-      obj_.push_back(obj);
-      if (obj_.size() > 6) {
-        Split();
+  uint32_t AllocItem(BoxedObj* obj) {
+    uint32_t i;
+    if (free_items_ != kNull) {
+      i = free_items_;
+      free_items_ = items_[i].next_;
+    } else {
+      i = item_cnt_++;
+      if (items_.size() < item_cnt_) {
+        items_.resize(item_cnt_);
       }
+    }
+    items_[i] = Item();
+    items_[i].obj_ = obj;
+    ++obj_cnt_;
+    Attach(obj);
+    obj->item_ = i;
+    return i;
+  }
+
+  void FreeItem(uint32_t i) {
+    items_[i].obj_ = nullptr;
+    --obj_cnt_;
+    items_[i].next_ = free_items_;
+    free_items_ = i;
+  }
+
+  void Link(uint32_t n, uint32_t i) {
+    Node& node = nodes_[n];
+    items_[i].prev_ = kNull;
+    items_[i].next_ = node.first_;
+    if (node.first_ != kNull) {
+      items_[node.first_].prev_ = i;
+    }
+    node.first_ = i;
+    Box& box = items_[i].obj_->box_;
+    if (node.count_ == 0) {
+      node.objbound_ = box;
     } else {
-      int pos = GetBoxPos(obj);
+      node.objbound_ = Union(node.objbound_, box);
+    }
+    ++node.count_;
+    items_[i].obj_->node_ = n;
+  }
+
+  void RecalcObjBound(uint32_t n) {
+    Node& node = nodes_[n];
+    bool first = true;
+    for (uint32_t i = node.first_; i != kNull; i = items_[i].next_) {
+      Box& box = items_[i].obj_->box_;
+      node.objbound_ = first ? box : Union(node.objbound_, box);
+      first = false;
+    }
+  }
+
+  void Unlink(uint32_t n, uint32_t i) {
+    Node& node = nodes_[n];
+    Item& item = items_[i];
+    if (item.prev_ != kNull) {
+      items_[item.prev_].next_ = item.next_;
+    } else {
+      node.first_ = item.next_;
+    }
+    if (item.next_ != kNull) {
+      items_[item.next_].prev_ = item.prev_;
+    }
+    --node.count_;
+  }
+
+  uint32_t AddChildren(uint32_t n) {
+    uint32_t c = AllocNodes();
+    Box bound = nodes_[n].bound_;
+    Vec2d half = bound.size_ / 2;
+    nodes_[c].bound_ = Box(bound.pos_, half);
+    nodes_[c + 1].bound_ = Box(bound.pos_ + Vec2d(half.x, 0), half);
+    nodes_[c + 2].bound_ = Box(bound.pos_ + Vec2d(0, half.y), half);
+    nodes_[c + 3].bound_ = Box(bound.pos_ + half, half);
+    for (uint32_t i = c; i < c + 4; ++i) {
+      nodes_[i].parent_ = n;
+    }
+    nodes_[n].child_ = c;
+    return c;
+  }
+
+  void Split(uint32_t n, int depth) {
+    uint32_t c = AddChildren(n);
+    Box bound = nodes_[n].bound_;
+
+    for (uint32_t i = nodes_[n].first_; i != kNull;) {
+      uint32_t next = items_[i].next_;
+      int pos = GetBoxPos(bound, items_[i].obj_->box_);
       if (pos != -1) {
-        nodes_[pos]->Insert(obj);
-      } else {
-        obj_.push_back(obj);
-      }
-    }
-  }
-
-  vector<BoxedObj*> Retrieve(Box box) {
-    vector<BoxedObj*> res = obj_;
-    int pos = GetBoxPos(box);
-    if (pos != -1 && nodes_[0] != nullptr) {
-      auto t = nodes_[pos]->Retrieve(box);
-      res.insert(res.end(), t.begin(), t.end());
-    } else if (pos == -1 && nodes_[0] != nullptr) {
-      double xmid = bound_.pos_.x + bound_.size_.x / 2;
-      double ymid = bound_.pos_.y + bound_.size_.y / 2;
-
-      bool is_left = (box.pos_.x + box.size_.x < xmid);
-      bool is_right = (box.pos_.x > xmid);
-      bool is_down = (box.pos_.y + box.size_.y < ymid);
-      bool is_up = (box.pos_.y > ymid);
-
-      if (is_up) {
-        auto t1 = nodes_[0]->Retrieve(box);
-        res.insert(res.end(), t1.begin(), t1.end());
-        auto t2 = nodes_[1]->Retrieve(box);
-        res.insert(res.end(), t2.begin(), t2.end());
-      } else if (is_down) {
-        auto t1 = nodes_[2]->Retrieve(box);
-        res.insert(res.end(), t1.begin(), t1.end());
-        auto t2 = nodes_[3]->Retrieve(box);
-        res.insert(res.end(), t2.begin(), t2.end());
-      } else if (is_left) {
-        auto t1 = nodes_[0]->Retrieve(box);
-        res.insert(res.end(), t1.begin(), t1.end());
-        auto t2 = nodes_[2]->Retrieve(box);
-        res.insert(res.end(), t2.begin(), t2.end());
-      } else if (is_right) {
-        auto t1 = nodes_[1]->Retrieve(box);
-        res.insert(res.end(), t1.begin(), t1.end());
-        auto t2 = nodes_[3]->Retrieve(box);
-        res.insert(res.end(), t2.begin(), t2.end());
-      } else {
-        for (int i = 0; i < 4; ++i) {
-          auto t = nodes_[i]->Retrieve(box);
-          res.insert(res.end(), t.begin(), t.end());
-        }
+        Unlink(n, i);
+        Link(c + pos, i);
       }
+      i = next;
     }
-    return res;
+    RecalcObjBound(n);
+
+    for (uint32_t i = c; i < c + 4; ++i) {
+      if (nodes_[i].count_ > capacity_ && depth + 1 < max_depth_) {
+        Split(i, depth + 1);
+      }
+    }
+  }
+
+  // 子节点全为叶子且对象总数不足以分裂时，将子节点并回此节点
+  void Merge(uint32_t n) {
+    uint32_t c = nodes_[n].child_;
+    if (c == kNull) {
+      return;
+    }
+    uint32_t cnt = nodes_[n].count_;
+    for (uint32_t i = c; i < c + 4; ++i) {
+      if (!nodes_[i].IsLeaf()) {
+        return;
+      }
+      cnt += nodes_[i].count_;
+    }
+    if (cnt > capacity_) {
+      return;
+    }
+    for (uint32_t i = c; i < c + 4; ++i) {
+      for (uint32_t j = nodes_[i].first_; j != kNull;) {
+        uint32_t next = items_[j].next_;
+        Link(n, j);
+        j = next;
+      }
+    }
+    nodes_[n].child_ = kNull;
+    FreeNodes(c);
   }
 
+  // 子节点只在box与其所在的象限相交时才访问，
+  // 祖先节点的判断累积起来即是按子树范围剪枝
+  template <bool kExact>
+  bool Query(uint32_t n, const Box& box, Visitor& visit) {
+    const Node& node = nodes_[n];
+    ++stats_.nodes;
+    if (!kExact || (node.count_ != 0 && node.objbound_.Overlaps(box))) {
+      for (uint32_t i = node.first_; i != kNull; i = items_[i].next_) {
+        BoxedObj* obj = items_[i].obj_;
+        ++stats_.candidates;
+        if (kExact && !obj->box_.Overlaps(box)) {
+          continue;
+        }
+        ++stats_.hits;
+        if (!visit(obj)) {
+          return false;
+        }
+      }
+    }
+    if (node.IsLeaf()) {
+      return true;
+    }
+    double xmid = node.bound_.pos_.x + node.bound_.size_.x / 2;
+    double ymid = node.bound_.pos_.y + node.bound_.size_.y / 2;
+    bool left = box.pos_.x <= xmid;
+    bool right = box.pos_.x + box.size_.x >= xmid;
+    bool top = box.pos_.y <= ymid;
+    bool bottom = box.pos_.y + box.size_.y >= ymid;
+    uint32_t c = node.child_;
+    if (left && top && !Query<kExact>(c, box, visit)) {
+      return false;
+    }
+    if (right && top && !Query<kExact>(c + 1, box, visit)) {
+      return false;
+    }
+    if (left && bottom && !Query<kExact>(c + 2, box, visit)) {
+      return false;
+    }
+    if (right && bottom && !Query<kExact>(c + 3, box, visit)) {
+      return false;
+    }
+    return true;
+  }
 };
 
 }  // namespace mocoder
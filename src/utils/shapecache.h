@@ -0,0 +1,117 @@
+/**
+ * @file shapecache.h
+ * @author MCMocoder (mcmocoder@ametav.com)
+ * @brief
+ * @version 0.1
+ * @date 2023-06-23
+ *
+ * @copyright Copyright (c) 2023 Mocoder Studio
+ *
+ */
+
+#pragma once
+
+#include <unicode/unistr.h>
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "harfbuzz/hb.h"
+
+namespace mocoder {
+
+using namespace icu_72;
+
+using namespace std;
+
+// 一段文字的排版结果，cluster相对于段首
+struct ShapedRun {
+  vector<hb_codepoint_t> glyphs;
+  vector<uint32_t> clusters;
+  vector<hb_glyph_position_t> positions;
+  double width = 0;
+};
+
+// 按(文字, 字体, 文字系统, 语言)缓存hb_shape的结果，由多个文本框共用。
+// 条目过多时整体清空，仍被文本框持有的结果不受影响
+class ShapeCache {
+ public:
+  static constexpr size_t kMaxEntries = 8192;
+
+  struct Key {
+    UnicodeString text;
+    hb_font_t* font;
+    hb_script_t script;
+    hb_language_t language;
+
+    bool operator==(const Key& b) const {
+      return font == b.font && script == b.script && language == b.language &&
+             text == b.text;
+    }
+  };
+
+  struct KeyHash {
+    size_t operator()(const Key& k) const {
+      size_t h = k.text.hashCode();
+      h = h * 31 + hash<const void*>()(k.font);
+      h = h * 31 + k.script;
+      return h * 31 + hash<const void*>()(k.language);
+    }
+  };
+
+  unordered_map<Key, shared_ptr<const ShapedRun>, KeyHash> runs_;
+
+  // 排版str中[start, end)的文字，命中时不调用HarfBuzz
+  shared_ptr<const ShapedRun> Shape(hb_font_t* font, const UnicodeString& str,
+                                    int start, int end, hb_script_t script,
+                                    hb_language_t language) {
+    Key key{UnicodeString(str, start, end - start), font, script, language};
+    auto it = runs_.find(key);
+    if (it != runs_.end()) {
+      return it->second;
+    }
+    auto run = Make(font, str, start, end, script, language);
+    if (runs_.size() >= kMaxEntries) {
+      runs_.clear();
+    }
+    runs_.emplace(std::move(key), run);
+    return run;
+  }
+
+  // 不经缓存直接排版
+  static shared_ptr<const ShapedRun> Make(hb_font_t* font,
+                                          const UnicodeString& str, int start,
+                                          int end, hb_script_t script,
+                                          hb_language_t language) {
+    hb_buffer_t* buf = hb_buffer_create();
+    hb_buffer_set_content_type(buf, HB_BUFFER_CONTENT_TYPE_UNICODE);
+    for (int j = start; j < end; ++j) {
+      hb_buffer_add(buf, str.char32At(j), j - start);
+    }
+    hb_buffer_set_direction(buf, HB_DIRECTION_LTR);
+    hb_buffer_set_script(buf, script);
+    hb_buffer_set_language(buf, language);
+    hb_shape(font, buf, NULL, 0);
+
+    unsigned int count = hb_buffer_get_length(buf);
+    hb_glyph_info_t* info = hb_buffer_get_glyph_infos(buf, NULL);
+    hb_glyph_position_t* pos = hb_buffer_get_glyph_positions(buf, NULL);
+    auto run = make_shared<ShapedRun>();
+    run->glyphs.reserve(count);
+    run->clusters.reserve(count);
+    run->positions.assign(pos, pos + count);
+    for (unsigned int i = 0; i < count; ++i) {
+      run->glyphs.push_back(info[i].codepoint);
+      run->clusters.push_back(info[i].cluster);
+      run->width += pos[i].x_advance / 64.0;
+    }
+    hb_buffer_destroy(buf);
+    return run;
+  }
+
+  void Clear() { runs_.clear(); }
+};
+
+}  // namespace mocoder
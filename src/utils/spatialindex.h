@@ -0,0 +1,211 @@
+/**
+ * @file spatialindex.h
+ * @author MCMocoder (mcmocoder@ametav.com)
+ * @brief
+ * @version 0.1
+ * @date 2023-06-12
+ *
+ * @copyright Copyright (c) 2023 Mocoder Studio
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "utils/boxedobj.h"
+
+namespace mocoder {
+
+using namespace std;
+
+// 不持有可调用对象的轻量函数引用，用于虚函数接口上传递lambda而不分配内存
+template <class Fn>
+class FunctionRef;
+
+template <class R, class... Args>
+class FunctionRef<R(Args...)> {
+ public:
+  template <class F, class = enable_if_t<
+                         !is_same_v<remove_cvref_t<F>, FunctionRef>>>
+  FunctionRef(F&& f)
+      : obj_((void*)addressof(f)), call_([](void* obj, Args... args) -> R {
+          return (*(remove_reference_t<F>*)obj)(forward<Args>(args)...);
+        }) {}
+
+  R operator()(Args... args) const {
+    return call_(obj_, forward<Args>(args)...);
+  }
+
+ private:
+  void* obj_;
+  R (*call_)(void*, Args...);
+};
+
+// 组件的空间索引接口，具体实现见quadtree.h、grid.h、aabbtree.h
+class SpatialIndex {
+ public:
+  using Visitor = FunctionRef<bool(BoxedObj*)>;
+  using NearestVisitor = FunctionRef<bool(BoxedObj*, double)>;
+
+  enum class Type { QUADTREE, GRID, BVH };
+
+  struct QueryStats {
+    uint64_t queries = 0;
+    uint64_t nodes = 0;       // 访问的节点或网格数
+    uint64_t candidates = 0;  // 检查过的对象数
+    uint64_t hits = 0;        // 交给visitor的对象数
+    double HitRatio() const {
+      return candidates == 0 ? 1.0 : (double)hits / candidates;
+    }
+    double NodesPerQuery() const {
+      return queries == 0 ? 0.0 : (double)nodes / queries;
+    }
+  };
+  QueryStats stats_;
+
+  virtual ~SpatialIndex() {}
+
+  virtual void Insert(BoxedObj* obj) = 0;
+  virtual void Remove(BoxedObj* obj) = 0;
+  // obj的包围盒改变后调用
+  virtual void Update(BoxedObj* obj) = 0;
+  virtual void Clear() = 0;
+  // 清空后用objs批量建立索引
+  virtual void Build(const vector<BoxedObj*>& objs) = 0;
+  virtual int Count() = 0;
+  // 每帧在查询之外调用一次，实现可借此按统计整理自身
+  virtual void Maintain() {}
+
+  // 对包围盒与box相交的每个对象调用visit，visit返回false时提前结束
+  // 返回值表示是否遍历完整
+  virtual bool QueryOverlap(const Box& box, Visitor visit) = 0;
+  // 对包围盒与线段p1->p2相交的每个对象调用visit
+  virtual bool QuerySegment(Vec2d p1, Vec2d p2, Visitor visit) = 0;
+  // 按包围盒到p的距离由近到远访问radius内的对象
+  virtual bool QueryNearest(Vec2d p, double radius, NearestVisitor visit) = 0;
+
+  bool Contains(BoxedObj* obj) {
+    return obj->index_ == this && obj->epoch_ == epoch_;
+  }
+
+  // 将结果追加到调用者提供的缓冲区，out可跨查询复用
+  void RetrieveOverlap(const Box& box, vector<BoxedObj*>& out) {
+    QueryOverlap(box, [&out](BoxedObj* obj) {
+      out.push_back(obj);
+      return true;
+    });
+  }
+
+  // 返回radius内离p最近且满足filter的对象，没有则返回nullptr
+  template <class Filter>
+  BoxedObj* Nearest(Vec2d p, double radius, Filter&& filter) {
+    BoxedObj* res = nullptr;
+    QueryNearest(p, radius, [&](BoxedObj* obj, double dist) {
+      if (filter(obj)) {
+        res = obj;
+        return false;
+      }
+      return true;
+    });
+    return res;
+  }
+
+  // 将radius内离p最近的至多k个满足filter的对象按距离升序追加到out
+  template <class Filter>
+  void KNearest(Vec2d p, int k, double radius, Filter&& filter,
+                vector<BoxedObj*>& out) {
+    int cnt = 0;
+    QueryNearest(p, radius, [&](BoxedObj* obj, double dist) {
+      if (cnt < k && filter(obj)) {
+        out.push_back(obj);
+        ++cnt;
+      }
+      return cnt < k;
+    });
+  }
+
+  void ResetStats() { stats_ = QueryStats(); }
+
+  static double Distance(Vec2d p, double minx, double miny, double maxx,
+                         double maxy) {
+    double dx = max(max(minx - p.x, p.x - maxx), 0.0);
+    double dy = max(max(miny - p.y, p.y - maxy), 0.0);
+    return sqrt(dx * dx + dy * dy);
+  }
+
+  static double Distance(Vec2d p, const Box& box) {
+    return Distance(p, box.pos_.x, box.pos_.y, box.pos_.x + box.size_.x,
+                    box.pos_.y + box.size_.y);
+  }
+
+  // 线段与闭区间矩形[minx, maxx]x[miny, maxy]是否相交，矩形的边可为无穷
+  static bool SegmentHitsBox(Vec2d p1, Vec2d p2, double minx, double miny,
+                             double maxx, double maxy) {
+    double tmin = 0.0, tmax = 1.0;
+    double p[2] = {p1.x, p1.y};
+    double d[2] = {p2.x - p1.x, p2.y - p1.y};
+    double lo[2] = {minx, miny};
+    double hi[2] = {maxx, maxy};
+    for (int i = 0; i < 2; ++i) {
+      if (d[i] == 0.0) {
+        if (p[i] < lo[i] || p[i] > hi[i]) {
+          return false;
+        }
+        continue;
+      }
+      double t0 = (lo[i] - p[i]) / d[i];
+      double t1 = (hi[i] - p[i]) / d[i];
+      if (t0 > t1) {
+        swap(t0, t1);
+      }
+      tmin = max(tmin, t0);
+      tmax = min(tmax, t1);
+      if (tmin > tmax) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static bool SegmentHitsBox(Vec2d p1, Vec2d p2, const Box& box) {
+    return SegmentHitsBox(p1, p2, box.pos_.x, box.pos_.y,
+                          box.pos_.x + box.size_.x, box.pos_.y + box.size_.y);
+  }
+
+  static Box Union(const Box& a, const Box& b) { return a.Join(b); }
+
+  static bool InBound(const Box& bound, const Box& box) {
+    return box.pos_.x >= bound.pos_.x && box.pos_.y >= bound.pos_.y &&
+           box.pos_.x + box.size_.x <= bound.pos_.x + bound.size_.x &&
+           box.pos_.y + box.size_.y <= bound.pos_.y + bound.size_.y;
+  }
+
+ protected:
+  uint32_t epoch_ = 0;  // 每次Clear后递增，使旧的对象句柄失效
+
+  void Attach(BoxedObj* obj) {
+    obj->index_ = this;
+    obj->epoch_ = epoch_;
+  }
+};
+
+inline void BoxedObj::UpdateNode() {
+  if (index_ != nullptr) {
+    index_->Update(this);
+  }
+}
+
+inline void BoxedObj::DetachNode() {
+  if (index_ != nullptr) {
+    index_->Remove(this);
+  }
+}
+
+}  // namespace mocoder
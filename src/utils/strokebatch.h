@@ -0,0 +1,92 @@
+/**
+ * @file strokebatch.h
+ * @author MCMocoder (mcmocoder@ametav.com)
+ * @brief
+ * @version 0.1
+ * @date 2023-06-19
+ *
+ * @copyright Copyright (c) 2023 Mocoder Studio
+ *
+ */
+
+#pragma once
+
+#define SK_GANESH
+#define SK_GL
+#include "include/core/SkCanvas.h"
+#include "include/core/SkColor.h"
+#include "include/core/SkPaint.h"
+#include "include/core/SkPath.h"
+#include "include/core/SkPathEffect.h"
+#include "include/effects/SkDashPathEffect.h"
+
+namespace mocoder {
+
+// 按画笔样式收集组件外形，每种样式合并成一条路径一次画完，
+// 绘制次数与组件数量无关。同一样式颜色相同，其内的先后顺序不影响结果
+class StrokeBatch {
+ public:
+  // 绘制顺序即枚举顺序，选中的组件画在上面；
+  // FILL与GREEK为远景下的填充盒子与代替文字的灰条
+  enum Style { FILL, GREEK, NORMAL, SELECTED, DASHED, kStyleCount };
+
+  SkPath paths_[kStyleCount];
+  // 只在Begin与Flush之间收集，其余时间组件自行绘制
+  bool active_ = false;
+
+  static SkPaint MakePaint(Style style) {
+    SkPaint paint;
+    if (style == FILL || style == GREEK) {
+      paint.setStyle(SkPaint::kFill_Style);
+      paint.setColor(style == FILL ? SK_ColorLTGRAY : SK_ColorGRAY);
+      return paint;
+    }
+    paint.setStyle(SkPaint::kStroke_Style);
+    paint.setAntiAlias(true);
+    paint.setStrokeWidth(2);
+    paint.setColor(style == NORMAL ? SK_ColorBLACK : SK_ColorBLUE);
+    if (style == DASHED) {
+      static const sk_sp<SkPathEffect> dash = [] {
+        float interval[] = {10, 20};
+        return SkDashPathEffect::Make(interval, 2, 0.0f);
+      }();
+      paint.setPathEffect(dash);
+    }
+    return paint;
+  }
+
+  void Begin() {
+    for (auto& i : paths_) {
+      i.rewind();
+    }
+    active_ = true;
+  }
+
+  // 将以(dx, dy)为原点的path加入style对应的路径，未开始收集时返回false
+  bool Add(Style style, const SkPath& path, double dx, double dy) {
+    if (!active_) {
+      return false;
+    }
+    paths_[style].addPath(path, dx, dy);
+    return true;
+  }
+
+  bool AddRect(Style style, const SkRect& rect) {
+    if (!active_) {
+      return false;
+    }
+    paths_[style].addRect(rect);
+    return true;
+  }
+
+  void Flush(SkCanvas* canvas) {
+    for (int i = 0; i < kStyleCount; ++i) {
+      if (!paths_[i].isEmpty()) {
+        canvas->drawPath(paths_[i], MakePaint((Style)i));
+      }
+    }
+    active_ = false;
+  }
+};
+
+}  // namespace mocoder
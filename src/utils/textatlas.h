@@ -0,0 +1,298 @@
+/**
+ * @file textatlas.h
+ * @author MCMocoder (mcmocoder@ametav.com)
+ * @brief
+ * @version 0.1
+ * @date 2023-06-16
+ *
+ * @copyright Copyright (c) 2023 Mocoder Studio
+ *
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#define SK_GANESH
+#define SK_GL
+#include "include/core/SkBlendMode.h"
+#include "include/core/SkCanvas.h"
+#include "include/core/SkImage.h"
+#include "include/core/SkRSXform.h"
+#include "include/core/SkSamplingOptions.h"
+#include "include/core/SkSurface.h"
+#include "include/gpu/GrDirectContext.h"
+
+namespace mocoder {
+
+using namespace std;
+
+// 将各文本框排版后的图像装入少数几张大纹理，每页按行(shelf)分配空间，
+// 每帧同一页上的文字用一次drawAtlas画完。
+// 页满时整页淘汰最久未用的一页，其上的文字下次绘制时重新装入
+class TextAtlas {
+ public:
+  static constexpr int kPageSize = 1024;
+  static constexpr int kMaxPages = 4;
+  // 相邻图像之间留出的空隙，防止采样越界
+  static constexpr int kPadding = 1;
+
+  // 图像在图集中的位置，gen与条目不符说明已被淘汰
+  struct Slot {
+    int id = -1;
+    uint32_t gen = 0;
+  };
+
+  struct Entry {
+    int page = -1;
+    int x = 0, y = 0, w = 0, h = 0;
+    uint32_t gen = 0;
+  };
+
+  struct Shelf {
+    int y = 0, h = 0, x = 0;
+  };
+
+  struct Page {
+    sk_sp<SkSurface> surface;
+    sk_sp<SkImage> image;
+    vector<Shelf> shelves;
+    int next_y = 0;
+    int live = 0;
+    uint64_t last_used = 0;
+    // 本帧排队等待绘制的文字
+    vector<SkRSXform> xforms;
+    vector<SkRect> texs;
+  };
+
+  GrDirectContext* context_ = nullptr;
+  vector<Page> pages_;
+  vector<Entry> entries_;
+  vector<int> free_;
+  uint64_t frame_ = 1;
+
+  bool Has(const Slot& slot) const {
+    return slot.id >= 0 && slot.id < entries_.size() &&
+           entries_[slot.id].gen == slot.gen && entries_[slot.id].page >= 0;
+  }
+
+  // 将图像装入图集，放不下时返回无效的Slot，调用者应直接绘制图像
+  Slot Put(const sk_sp<SkImage>& image) {
+    Slot slot;
+    if (image == nullptr) {
+      return slot;
+    }
+    int w = image->width() + kPadding, h = image->height() + kPadding;
+    if (w > kPageSize || h > kPageSize) {
+      return slot;
+    }
+    int page = -1, x = 0, y = 0;
+    for (int i = 0; i < pages_.size() && page < 0; ++i) {
+      if (Allocate(pages_[i], w, h, &x, &y)) {
+        page = i;
+      }
+    }
+    if (page < 0 && pages_.size() < kMaxPages) {
+      Page p;
+      SkImageInfo info = SkImageInfo::MakeN32Premul(kPageSize, kPageSize);
+      p.surface = context_ != nullptr ? SkSurface::MakeRenderTarget(
+                                            context_, SkBudgeted::kNo, info)
+                                      : SkSurface::MakeRaster(info);
+      if (p.surface == nullptr) {
+        return slot;
+      }
+      p.surface->getCanvas()->clear(SK_ColorTRANSPARENT);
+      pages_.push_back(std::move(p));
+      page = pages_.size() - 1;
+      Allocate(pages_[page], w, h, &x, &y);
+    }
+    if (page < 0) {
+      page = Evict();
+      if (page < 0 || !Allocate(pages_[page], w, h, &x, &y)) {
+        return slot;
+      }
+    }
+
+    Page& p = pages_[page];
+    // 先丢弃快照，避免写入时复制整页
+    p.image = nullptr;
+    p.surface->getCanvas()->drawImage(image, x, y);
+    ++p.live;
+
+    if (free_.empty()) {
+      entries_.push_back(Entry());
+      slot.id = entries_.size() - 1;
+    } else {
+      slot.id = free_.back();
+      free_.pop_back();
+    }
+    Entry& e = entries_[slot.id];
+    e.page = page;
+    e.x = x;
+    e.y = y;
+    e.w = image->width();
+    e.h = image->height();
+    slot.gen = e.gen;
+    return slot;
+  }
+
+  void Free(Slot& slot) {
+    if (Has(slot)) {
+      Entry& e = entries_[slot.id];
+      Page& p = pages_[e.page];
+      if (--p.live == 0) {
+        ClearPage(p);
+      }
+      Release(slot.id);
+    }
+    slot = Slot();
+  }
+
+  // 在(x, y)处按scale倍绘制slot中的图像，Flush时才真正绘制
+  void Queue(const Slot& slot, double x, double y, double scale = 1) {
+    const Entry& e = entries_[slot.id];
+    Page& p = pages_[e.page];
+    p.xforms.push_back(SkRSXform::Make(scale, 0, x, y));
+    p.texs.push_back(SkRect::MakeXYWH(e.x, e.y, e.w, e.h));
+    p.last_used = frame_;
+  }
+
+  // 每页一次drawAtlas绘制排队的文字，一次重绘中可多次调用
+  void Flush(SkCanvas* canvas) {
+    for (auto& p : pages_) {
+      if (p.xforms.empty()) {
+        continue;
+      }
+      if (p.image == nullptr) {
+        p.image = p.surface->makeImageSnapshot();
+      }
+      // 视图缩放后文字不再与像素对齐，使用线性采样；图像间的空隙防止串色
+      canvas->drawAtlas(p.image.get(), p.xforms.data(), p.texs.data(),
+                        nullptr, p.xforms.size(), SkBlendMode::kSrcOver,
+                        SkSamplingOptions(SkFilterMode::kLinear), nullptr,
+                        nullptr);
+      p.xforms.clear();
+      p.texs.clear();
+    }
+  }
+
+  // 每次重绘结束时调用，本帧用过的页不会被淘汰
+  void NextFrame() { ++frame_; }
+
+  // 释放全部纹理，已发出的Slot全部失效
+  void Reset() {
+    pages_.clear();
+    free_.clear();
+    for (int i = 0; i < entries_.size(); ++i) {
+      if (entries_[i].page >= 0) {
+        entries_[i].page = -1;
+        ++entries_[i].gen;
+      }
+      free_.push_back(i);
+    }
+  }
+
+ private:
+  // 在已有的行中找高度最接近的放入，都放不下时新开一行
+  static bool Allocate(Page& p, int w, int h, int* x, int* y) {
+    Shelf* best = nullptr;
+    for (auto& s : p.shelves) {
+      if (s.h >= h && s.x + w <= kPageSize &&
+          (best == nullptr || s.h < best->h)) {
+        best = &s;
+      }
+    }
+    // 行高远大于图像时宁可新开一行，以免浪费空间
+    if (best == nullptr || (best->h > h * 2 && p.next_y + h <= kPageSize)) {
+      if (p.next_y + h > kPageSize) {
+        return false;
+      }
+      p.shelves.push_back(Shelf{p.next_y, h, 0});
+      p.next_y += h;
+      best = &p.shelves.back();
+    }
+    *x = best->x;
+    *y = best->y;
+    best->x += w;
+    return true;
+  }
+
+  // 淘汰本帧未用且最久未用的一页，返回其下标
+  int Evict() {
+    int res = -1;
+    for (int i = 0; i < pages_.size(); ++i) {
+      if (pages_[i].last_used == frame_) {
+        continue;
+      }
+      if (res < 0 || pages_[i].last_used < pages_[res].last_used) {
+        res = i;
+      }
+    }
+    if (res < 0) {
+      return res;
+    }
+    for (int i = 0; i < entries_.size(); ++i) {
+      if (entries_[i].page == res) {
+        Release(i);
+      }
+    }
+    ClearPage(pages_[res]);
+    return res;
+  }
+
+  void ClearPage(Page& p) {
+    p.shelves.clear();
+    p.next_y = 0;
+    p.live = 0;
+    p.image = nullptr;
+    p.surface->getCanvas()->clear(SK_ColorTRANSPARENT);
+  }
+
+  void Release(int id) {
+    entries_[id].page = -1;
+    ++entries_[id].gen;
+    free_.push_back(id);
+  }
+};
+
+// 持有图集中的一个位置，析构时归还；
+// 复制时不共享位置，副本在首次绘制时自行装入
+class AtlasHandle {
+ public:
+  TextAtlas* atlas = nullptr;
+  TextAtlas::Slot slot;
+
+  AtlasHandle() = default;
+  AtlasHandle(const AtlasHandle& b) : atlas(b.atlas) {}
+  AtlasHandle& operator=(const AtlasHandle& b) {
+    Release();
+    atlas = b.atlas;
+    return *this;
+  }
+  ~AtlasHandle() { Release(); }
+
+  void Release() {
+    if (atlas != nullptr) {
+      atlas->Free(slot);
+    }
+  }
+
+  // 通过图集按scale倍绘制image，没有图集或放不下时返回false
+  bool Draw(const sk_sp<SkImage>& image, double x, double y,
+            double scale = 1) {
+    if (atlas == nullptr) {
+      return false;
+    }
+    if (!atlas->Has(slot)) {
+      slot = atlas->Put(image);
+      if (!atlas->Has(slot)) {
+        return false;
+      }
+    }
+    atlas->Queue(slot, x, y, scale);
+    return true;
+  }
+};
+
+}  // namespace mocoder
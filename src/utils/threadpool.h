@@ -0,0 +1,129 @@
+/**
+ * @file threadpool.h
+ * @author MCMocoder (mcmocoder@ametav.com)
+ * @brief
+ * @version 0.1
+ * @date 2023-06-18
+ *
+ * @copyright Copyright (c) 2023 Mocoder Studio
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace mocoder {
+
+using namespace std;
+
+// 固定数量的工作线程，一次执行一批下标互不相关的任务
+class ThreadPool {
+ public:
+  // threads为0时按CPU核数创建，调用线程也参与执行，故少建一个
+  explicit ThreadPool(unsigned threads = 0) {
+    if (threads == 0) {
+      threads = max(1u, thread::hardware_concurrency());
+    }
+    for (unsigned i = 1; i < threads; ++i) {
+      workers_.emplace_back([this] { Work(); });
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      lock_guard<mutex> lock(mutex_);
+      stop_ = true;
+    }
+    wake_.notify_all();
+    for (auto& i : workers_) {
+      i.join();
+    }
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  int Size() const { return workers_.size() + 1; }
+
+  // 对[0, n)中的每个下标调用一次f，全部完成后返回
+  void ParallelFor(int n, const function<void(int)>& f) {
+    if (n <= 0) {
+      return;
+    }
+    if (workers_.empty() || n == 1) {
+      for (int i = 0; i < n; ++i) {
+        f(i);
+      }
+      return;
+    }
+    {
+      lock_guard<mutex> lock(mutex_);
+      job_ = &f;
+      count_ = n;
+      next_ = 0;
+      done_ = 0;
+      ++batch_;
+    }
+    wake_.notify_all();
+    Run();
+    unique_lock<mutex> lock(mutex_);
+    finished_.wait(lock, [this] { return done_ == count_ && busy_ == 0; });
+    job_ = nullptr;
+  }
+
+ private:
+  vector<thread> workers_;
+  mutex mutex_;
+  condition_variable wake_, finished_;
+  const function<void(int)>* job_ = nullptr;
+  int count_ = 0;
+  atomic<int> next_ = 0;
+  int done_ = 0;
+  // 正在执行本批任务的工作线程数，全部退出后job_才可释放
+  int busy_ = 0;
+  unsigned batch_ = 0;
+  bool stop_ = false;
+
+  // 领取下标直到本批任务分完
+  void Run() {
+    int finished = 0;
+    for (int i = next_++; i < count_; i = next_++) {
+      (*job_)(i);
+      ++finished;
+    }
+    if (finished > 0) {
+      lock_guard<mutex> lock(mutex_);
+      done_ += finished;
+    }
+  }
+
+  void Work() {
+    unsigned seen = 0;
+    while (true) {
+      {
+        unique_lock<mutex> lock(mutex_);
+        wake_.wait(lock, [&] { return stop_ || (job_ && batch_ != seen); });
+        if (stop_) {
+          return;
+        }
+        seen = batch_;
+        ++busy_;
+      }
+      Run();
+      {
+        lock_guard<mutex> lock(mutex_);
+        --busy_;
+      }
+      finished_.notify_one();
+    }
+  }
+};
+
+}  // namespace mocoder
@@ -0,0 +1,79 @@
+/**
+ * @file tiledraster.h
+ * @author MCMocoder (mcmocoder@ametav.com)
+ * @brief
+ * @version 0.1
+ * @date 2023-06-18
+ *
+ * @copyright Copyright (c) 2023 Mocoder Studio
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "utils/box.h"
+#include "utils/threadpool.h"
+
+#define SK_GANESH
+#define SK_GL
+#include "include/core/SkCanvas.h"
+#include "include/core/SkPicture.h"
+#include "include/core/SkPixmap.h"
+
+namespace mocoder {
+
+using namespace std;
+
+// 将画面分块，与脏区域相交的块在线程池中并行回放同一个SkPicture。
+// 各块写入目标像素中互不重叠的部分，无需加锁
+class TiledRasterizer {
+ public:
+  static constexpr int kTileSize = 256;
+
+  ThreadPool pool_;
+  // 本次需要绘制的块，帧间复用
+  vector<SkIRect> tiles_;
+
+  explicit TiledRasterizer(unsigned threads = 0) : pool_(threads) {}
+
+  void Draw(const SkPixmap& dst, const sk_sp<SkPicture>& picture,
+            const vector<Box>& dirty) {
+    int w = dst.width(), h = dst.height();
+    int cols = (w + kTileSize - 1) / kTileSize;
+    int rows = (h + kTileSize - 1) / kTileSize;
+    tiles_.clear();
+    for (int r = 0; r < rows; ++r) {
+      for (int c = 0; c < cols; ++c) {
+        int x = c * kTileSize, y = r * kTileSize;
+        int tw = min(kTileSize, w - x), th = min(kTileSize, h - y);
+        Box tile(Vec2d(x, y), Vec2d(tw, th));
+        for (auto& i : dirty) {
+          if (tile.Overlaps(i)) {
+            tiles_.push_back(SkIRect::MakeXYWH(x, y, tw, th));
+            break;
+          }
+        }
+      }
+    }
+    pool_.ParallelFor(tiles_.size(), [&](int i) {
+      const SkIRect& tile = tiles_[i];
+      SkPixmap sub;
+      if (!dst.extractSubset(&sub, tile)) {
+        return;
+      }
+      auto canvas = SkCanvas::MakeRasterDirect(sub.info(), sub.writable_addr(),
+                                               sub.rowBytes());
+      if (canvas == nullptr) {
+        return;
+      }
+      canvas->translate(-tile.x(), -tile.y());
+      canvas->drawPicture(picture);
+    });
+  }
+};
+
+}  // namespace mocoder